@@ -0,0 +1,313 @@
+/*
+#  bench - run poster over a corpus of inputs and grid sizes
+#
+#  Usage: bench [-s] [-r runs] [-b baseline] [-o results] poster corpusdir
+#
+#  Every input of corpusdir is converted at every grid size, each
+#  case runs several times and the fastest run counts.  Per case it
+#  reports the tiles made, wall time, MB/s read and written, tiles/s
+#  and the peak RSS of poster.  With -b, the wall times are compared
+#  against a baseline (an earlier output of bench), and the exit
+#  status is 1 when a case got clearly slower.
+#
+#  With -s, the smallest input is converted at grids up to over a
+#  hundred thousand tiles instead, and the exit status is 1 when the
+#  memory of poster grows with the tiles, or the time per tile does.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAXFILES 64
+#define Slower 1.25		/* this much slower is a regression... */
+#define MinDelta 0.05		/* ...when it is more than this many seconds */
+#define ScaleKB 512		/* with -s: memory the largest grid may add, */
+				/* in kB; far less than a few bytes a tile */
+#define ScaleTime 2.0		/* with -s: per tile, the largest grid may be */
+				/* this much slower than the smallest */
+
+static int grids[] = { 1, 2, 5, 10, 20 };
+#define NGRIDS (int)(sizeof( grids) / sizeof( grids[0]))
+/* from well past the output buffers of poster on */
+static int scalegrids[] = { 100, 200, 300, 400 };
+#define NSCALEGRIDS (int)(sizeof( scalegrids) / sizeof( scalegrids[0]))
+
+struct result {
+	char name[64];
+	int grid, tiles;
+	double wall, inrate, outrate, tilerate;
+	long rss;		/* kB */
+};
+
+static double now( void)
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* run poster once on input with grid; count its output */
+static int run( char *poster, char *input, int grid, double *wall,
+		double *outbytes, int *tiles, long *rss)
+{
+	static char buf[8 + 64*1024];
+	char spec[32], *data = buf + 8;	/* room for the end of the last read */
+	int fd[2], st, i;
+	size_t nc = 0;
+	ssize_t n;
+	struct rusage ru;
+	pid_t pid;
+	double t0;
+
+	snprintf( spec, sizeof( spec), "-p%dx%dA4", grid, grid);
+	if (pipe( fd) < 0)
+		return -1;
+	t0 = now();
+	if ((pid = fork()) < 0)
+		return -1;
+	if (pid == 0)
+	{	dup2( fd[1], 1);
+		close( fd[0]);
+		close( fd[1]);
+		execl( poster, poster, "-L0", "-mA4", spec, input, (char *)NULL);
+		fprintf( stderr, "bench: cannot run '%s'\n", poster);
+		_exit( 127);
+	}
+	close( fd[1]);
+
+	/* count bytes and pages, as a printer spooler would read them; */
+	/* "\n%%Page:" may straddle two reads */
+	*outbytes = 0;
+	*tiles = 0;
+	while ((n = read( fd[0], data, sizeof( buf) - 8)) != 0)
+	{	if (n < 0)
+		{	if (errno == EINTR) continue;
+			break;
+		}
+		*outbytes += n;
+		for (i = -(int)nc; i + 8 <= n; i++)
+			if (data[i] == '\n' && !memcmp( data + i, "\n%%Page:", 8))
+				(*tiles)++;
+		nc = n < 7 ? n : 7;
+		memmove( data - nc, data + n - nc, nc);
+	}
+	close( fd[0]);
+	if (wait4( pid, &st, 0, &ru) < 0)
+		return -1;
+	*wall = now() - t0;
+	*rss = ru.ru_maxrss;
+	return WIFEXITED( st) && WEXITSTATUS( st) == 0 ? 0 : -1;
+}
+
+static int cmpname( const void *a, const void *b)
+{
+	return strcmp( *(char **)a, *(char **)b);
+}
+
+/* the wall time of a case in the baseline, or -1 */
+static double baseline( char *file, char *name, int grid)
+{
+	char line[256], n[64];
+	int g, t;
+	double w;
+	FILE *fp;
+
+	if (!file || !(fp = fopen( file, "r")))
+		return -1;
+	while (fgets( line, sizeof( line), fp))
+		if (sscanf( line, "%63s %d %d %lf", n, &g, &t, &w) == 4 &&
+		    !strcmp( n, name) && g == grid)
+		{	fclose( fp);
+			return w;
+		}
+	fclose( fp);
+	return -1;
+}
+
+/* convert input at growing grids, and see that the memory and the */
+/* time per tile stay the same */
+static int scaling( char *poster, char *input, char *name, int runs)
+{
+	struct result r[NSCALEGRIDS];
+	double wall, outbytes, growth;
+	int g, i, tiles;
+	long rss;
+
+	printf( "# %-14s %4s %6s %8s %9s %8s\n", "input", "grid", "tiles",
+		"wall_s", "us/tile", "rss_kB");
+	for (g = 0; g < NSCALEGRIDS; g++)
+	{	memset( r + g, 0, sizeof( r[g]));
+		r[g].grid = scalegrids[g];
+		r[g].wall = -1;
+		for (i = 0; i < runs; i++)
+		{	if (run( poster, input, r[g].grid, &wall, &outbytes,
+				 &tiles, &rss) < 0)
+			{	fprintf( stderr, "bench: poster failed on %s at %dx%d\n",
+					name, r[g].grid, r[g].grid);
+				return 2;
+			}
+			if (r[g].wall < 0 || wall < r[g].wall)
+				r[g].wall = wall;
+			if (rss > r[g].rss)
+				r[g].rss = rss;
+			r[g].tiles = tiles;
+		}
+		printf( "%-16s %4d %6d %8.3f %9.2f %8ld\n", name, r[g].grid,
+			r[g].tiles, r[g].wall, 1e6 * r[g].wall / r[g].tiles, r[g].rss);
+		fflush( stdout);
+	}
+
+	g = NSCALEGRIDS - 1;
+	growth = (r[g].wall / r[g].tiles) / (r[0].wall / r[0].tiles);
+	printf( "# from %d to %d tiles: %ld kB more memory (at most %d),\n"
+		"# time per tile x%.2f (at most x%.2f)\n", r[0].tiles, r[g].tiles,
+		r[g].rss - r[0].rss, ScaleKB, growth, ScaleTime);
+	return r[g].rss - r[0].rss > ScaleKB || growth > ScaleTime ? 1 : 0;
+}
+
+static void report( FILE *fp, struct result *r, char *verdict)
+{
+	fprintf( fp, "%-16s %4d %5d %8.3f %9.1f %9.1f %9.1f %8ld%s\n",
+		r->name, r->grid, r->tiles, r->wall, r->inrate, r->outrate,
+		r->tilerate, r->rss, verdict);
+}
+
+int main( int argc, char *argv[])
+{
+	char *basefile = NULL, *outfile = NULL, *poster, *dirname;
+	char *files[MAXFILES], path[1024], verdict[64];
+	struct result r;
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	FILE *out = NULL;
+	int runs = 5, nfiles = 0, nslower = 0, nfailed = 0, opt, f, g, i, tiles;
+	int scale = 0, smallest = -1;
+	off_t smallsize = 0;
+	double wall, outbytes = 0, base, t0 = now();
+	long rss;
+
+	while ((opt = getopt( argc, argv, "sr:b:o:")) != -1)
+		switch (opt)
+		{ case 's': scale = 1; break;
+		  case 'r': runs = atoi( optarg); break;
+		  case 'b': basefile = optarg; break;
+		  case 'o': outfile = optarg; break;
+		  default:
+			fprintf( stderr, "Usage: %s [-s] [-r runs] [-b baseline] [-o results] poster corpusdir\n",
+				argv[0]);
+			return 2;
+		}
+	if (argc - optind != 2 || runs < 1)
+	{	fprintf( stderr, "Usage: %s [-s] [-r runs] [-b baseline] [-o results] poster corpusdir\n",
+			argv[0]);
+		return 2;
+	}
+	poster = argv[optind];
+	dirname = argv[optind+1];
+	if (!(dir = opendir( dirname)))
+	{	fprintf( stderr, "bench: cannot read '%s'\n", dirname);
+		return 2;
+	}
+	while ((de = readdir( dir)) && nfiles < MAXFILES)
+		if (de->d_name[0] != '.')
+			files[nfiles++] = strdup( de->d_name);
+	closedir( dir);
+	qsort( files, nfiles, sizeof( char *), cmpname);
+	if (scale)
+	{	for (f = 0; f < nfiles; f++)
+		{	snprintf( path, sizeof( path), "%s/%s", dirname, files[f]);
+			if (stat( path, &st) == 0 && (smallest < 0 || st.st_size < smallsize))
+			{	smallest = f;
+				smallsize = st.st_size;
+			}
+		}
+		if (smallest < 0)
+		{	fprintf( stderr, "bench: no inputs in '%s'\n", dirname);
+			return 2;
+		}
+		snprintf( path, sizeof( path), "%s/%s", dirname, files[smallest]);
+		return scaling( poster, path, files[smallest], runs);
+	}
+	if (outfile && !(out = fopen( outfile, "w")))
+	{	fprintf( stderr, "bench: cannot write '%s'\n", outfile);
+		return 2;
+	}
+	if (basefile && access( basefile, R_OK) < 0)
+	{	fprintf( stderr, "bench: no baseline '%s' yet, not comparing\n", basefile);
+		basefile = NULL;
+	}
+
+	snprintf( verdict, sizeof( verdict), "%s", basefile ? "  vs baseline" : "");
+	printf( "# %-14s %4s %5s %8s %9s %9s %9s %8s%s\n", "input", "grid", "tiles",
+		"wall_s", "in_MB/s", "out_MB/s", "tiles/s", "rss_kB", verdict);
+	if (out)
+		fprintf( out, "# %-14s %4s %5s %8s %9s %9s %9s %8s\n", "input", "grid",
+			"tiles", "wall_s", "in_MB/s", "out_MB/s", "tiles/s", "rss_kB");
+	for (f = 0; f < nfiles; f++)
+	{	snprintf( path, sizeof( path), "%s/%s", dirname, files[f]);
+		if (stat( path, &st) < 0)
+			continue;
+		for (g = 0; g < NGRIDS; g++)
+		{	memset( &r, 0, sizeof( r));
+			snprintf( r.name, sizeof( r.name), "%s", files[f]);
+			r.grid = grids[g];
+			r.wall = -1;
+			for (i = 0; i < runs; i++)
+			{	if (run( poster, path, r.grid, &wall, &outbytes,
+					 &tiles, &rss) < 0)
+				{	fprintf( stderr, "bench: poster failed on %s at %dx%d\n",
+						files[f], r.grid, r.grid);
+					nfailed++;
+					break;
+				}
+				if (r.wall < 0 || wall < r.wall)
+					r.wall = wall;
+				if (rss > r.rss)
+					r.rss = rss;
+				r.tiles = tiles;
+			}
+			if (i < runs)
+				continue;
+			r.inrate = st.st_size / r.wall / 1e6;
+			r.outrate = outbytes / r.wall / 1e6;
+			r.tilerate = r.tiles / r.wall;
+
+			verdict[0] = '\0';
+			if ((base = baseline( basefile, r.name, r.grid)) > 0)
+			{	if (r.wall > base * Slower && r.wall - base > MinDelta)
+				{	snprintf( verdict, sizeof( verdict),
+						"  SLOWER %+.0f%%", 100 * (r.wall / base - 1));
+					nslower++;
+				} else
+					snprintf( verdict, sizeof( verdict),
+						"  %+.0f%%", 100 * (r.wall / base - 1));
+			}
+			report( stdout, &r, verdict);
+			fflush( stdout);
+			if (out)
+				report( out, &r, "");
+		}
+	}
+	printf( "# %d inputs, %d runs per case, %.1f s", nfiles, runs, now() - t0);
+	if (basefile)
+		printf( ", %d case%s slower than the baseline", nslower,
+			nslower==1?"":"s");
+	printf( "\n");
+	if (out && fclose( out))
+	{	fprintf( stderr, "bench: write error on '%s'\n", outfile);
+		return 2;
+	}
+	return nfailed ? 2 : nslower ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+/*
+#  gen - write the synthetic input corpus for the poster benchmark
+#
+#  Usage: gen [dir]     (default dir: corpus)
+#
+#  Every input stresses another part of poster: the DSC scan,
+#  long lines, a deferred bounding box, image cropping of hex and
+#  binary rasters, and a trailing cntl-D.  The contents come from
+#  a fixed pseudo random sequence, so runs are comparable.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static unsigned long seed = 12345;
+static char *dir = "corpus";
+
+static int rnd( int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % n;
+}
+
+static FILE *create( char *name)
+{
+	char path[1024];
+	FILE *fp;
+
+	snprintf( path, sizeof( path), "%s/%s", dir, name);
+	if (!(fp = fopen( path, "w")))
+	{	fprintf( stderr, "gen: cannot write '%s'\n", path);
+		exit( 1);
+	}
+	return fp;
+}
+
+static void header( FILE *fp, char *bbox)
+{
+	fprintf( fp, "%%!PS-Adobe-3.0 EPSF-3.0\n"
+		"%%%%Creator: poster bench\n"
+		"%%%%BoundingBox: %s\n"
+		"%%%%EndComments\n", bbox);
+}
+
+/* a small vector drawing */
+static void tiny( void)
+{
+	FILE *fp = create( "tiny.eps");
+	int i;
+
+	header( fp, "0 0 200 200");
+	for (i = 0; i < 20; i++)
+		fprintf( fp, "%d %d moveto %d %d lineto stroke\n",
+			rnd( 200), rnd( 200), rnd( 200), rnd( 200));
+	fprintf( fp, "showpage\n%%%%EOF\n");
+	fclose( fp);
+}
+
+/* lines of 1M characters, with comment lines in between */
+static void longlines( void)
+{
+	FILE *fp = create( "longlines.eps");
+	int i, j;
+
+	header( fp, "0 0 500 500");
+	for (i = 0; i < 3; i++)
+	{	fprintf( fp, "%% a comment line, stripped in the output\n");
+		for (j = 0; j < 40000; j++)
+			fprintf( fp, "%03d %03d lineto ", rnd( 500), rnd( 500));
+		fprintf( fp, "stroke\n");
+	}
+	fprintf( fp, "showpage\n%%%%EOF\n");
+	fclose( fp);
+}
+
+/* the bounding box in the trailer, after 2MB of drawing */
+static void atend( void)
+{
+	FILE *fp = create( "atend.eps");
+	int i;
+
+	header( fp, "(atend)");
+	for (i = 0; i < 70000; i++)
+		fprintf( fp, "%d %d moveto %d %d lineto stroke\n",
+			rnd( 600), rnd( 400), rnd( 600), rnd( 400));
+	fprintf( fp, "showpage\n%%%%Trailer\n%%%%BoundingBox: 0 0 600 400\n%%%%EOF\n");
+	fclose( fp);
+}
+
+/* one sampled image, placed with translate and scale */
+static void raster( char *name, int w, int h, int binary)
+{
+	FILE *fp = create( name);
+	char bbox[64], *op = "false 3 colorimage\n";
+	int x, y;
+
+	snprintf( bbox, sizeof( bbox), "0 0 %d %d", w, h);
+	header( fp, bbox);
+	fprintf( fp, "/picstr %d string def\n"
+		"%d %d scale\n"
+		"%d %d 8 [%d 0 0 -%d 0 %d]\n"
+		"{currentfile picstr %s pop}\n",
+		3*w, w, h, w, h, w, h, h, binary ? "readstring" : "readhexstring");
+	/* binary: the operator and its samples, as DSC wants it */
+	if (binary)
+		fprintf( fp, "%%%%BeginBinary: %d\n", (int)strlen( op) + 3*w*h);
+	fputs( op, fp);
+	for (y = 0; y < h; y++)
+	{	for (x = 0; x < 3*w; x++)
+			if (binary)
+				putc( (x ^ y) + rnd( 16), fp);
+			else
+				fprintf( fp, "%02x", ((x ^ y) + rnd( 16)) & 0xff);
+		if (!binary)
+			putc( '\n', fp);
+	}
+	if (binary)
+		fprintf( fp, "\n%%%%EndBinary\n");
+	fprintf( fp, "showpage\n%%%%EOF\n");
+	fclose( fp);
+}
+
+/* a document from a spooler, that ends with a cntl-D */
+static void ctrld( void)
+{
+	FILE *fp = create( "ctrld.ps");
+	int i;
+
+	fprintf( fp, "%%!PS-Adobe-2.0\n%%%%BoundingBox: 0 0 612 792\n%%%%EndComments\n");
+	for (i = 0; i < 20000; i++)
+		fprintf( fp, "%d %d moveto (text %d) show\n", rnd( 612), rnd( 792), i);
+	fprintf( fp, "showpage\n%%%%EOF\n%c", 4);
+	fclose( fp);
+}
+
+int main( int argc, char *argv[])
+{
+	if (argc > 1)
+		dir = argv[1];
+	mkdir( dir, 0777);
+	tiny();
+	longlines();
+	atend();
+	raster( "hexraster.eps", 600, 600, 0);
+	raster( "binraster.eps", 600, 600, 1);
+	ctrld();
+	return 0;
+}
@@ -0,0 +1,6215 @@
+/*
+#  libposter - the scaling and tiling engine of poster
+#
+#  This file holds everything `poster' does, except for the command
+#  line handling in poster.c.  All state of a run lives in a
+#  `struct poster_job' (see poster.h), so the library is reentrant:
+#  several jobs can run one after the other or on parallel threads
+#  in one process.  Errors are returned (as -1, with a message in
+#  job->errmsg), never exit()ed.
+#
+# --------------------------------------------------------------
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License
+#  as published by the Free Software Foundation.
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY;
+#  The full text of the GNU General Public License is supplied
+#  with 'poster' in the file LICENSE.
+#
+#  Copyright (C) 1999 Jos T.J. van Eijndhoven
+# --------------------------------------------------------------
+*/
+
+#define _GNU_SOURCE		/* copy_file_range() */
+#define BUFSIZE 1024
+#define OUTBUFSIZE (64*1024)
+#define PAGESIZE 4096		/* alignment of the writer buffers */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "poster.h"
+
+/* an output document under construction */
+struct out {
+	struct poster_job *job;
+	struct poster_sink *sink;
+	char *buf;		/* collects small writes for the sink */
+	size_t len;
+	size_t done;		/* bytes passed to the sink so far */
+	int err;
+	struct poster_stats *stats;	/* where its figures are added */
+	double tilestart;	/* when the first tile began */
+};
+
+/* a sink that counts what passes to another */
+struct counted {
+	struct poster_sink *sink;
+	double count;
+};
+
+/* a sink to the output, keeping a copy for the cache */
+struct cachefill {
+	struct poster_sink *sink;
+	int fd;
+	int err;
+};
+
+static int fail( struct poster_job *job, char *fmt, ...);
+static void note( struct poster_job *job, int level, char *fmt, ...);
+static int readinput( struct poster_job *job);
+static int makelayout( struct poster_job *job);
+static int makeoutput( struct poster_job *job, struct poster_sink *sink,
+		       int first, int npages, struct poster_stats *stats);
+static int output( struct poster_job *job, struct poster_sink *sink,
+		   int first, int npages, struct poster_stats *stats);
+static void tiledone( struct out *out, int i, size_t at);
+static void addstats( struct poster_stats *to, struct poster_stats *st);
+static void jsonstr( FILE *fp, const char *s);
+static int loadfile( struct poster_job *job);
+static int readstdin( struct poster_job *job, int fd);
+static int nextline( struct poster_job *job, char *buf, int size, size_t *pos);
+static int scanbody( struct poster_job *job);
+static size_t lineend( char *inbuf, size_t p, size_t limit);
+static size_t datasize( char *inbuf, size_t p, size_t end, size_t limit);
+static int addspan( struct poster_job *job, size_t start, size_t end);
+static int pagecomment( struct poster_job *job, size_t p, size_t end, int *level);
+/* where scanbody() is, as to the resources it may hoist */
+struct resscan {
+	int hoistable;		/* in the prolog or the document setup */
+	int done;		/* past them */
+	int depth;		/* of %%BeginResource */
+	int take;		/* the outer one began where hoistable */
+	size_t start;		/* ...there */
+};
+
+static int rescomment( struct poster_job *job, size_t p, size_t end, int level,
+		       struct resscan *rs);
+static int addresource( struct poster_job *job, size_t start, size_t end);
+static int hoisting( struct poster_job *job);
+static char *resname( struct poster_job *job, struct poster_span *r, int *len);
+static int index_load( struct poster_job *job);
+static int index_check( struct poster_job *job, int nspans, int npages,
+			int nresources, size_t dsclen, size_t trailer, long bodysize);
+static void index_save( struct poster_job *job);
+static int index_name( struct poster_job *job, char *path, char *name, size_t size);
+static unsigned long long index_hash( struct poster_job *job);
+static unsigned long long fnv( unsigned long long h, const char *p, size_t n);
+static int cache_name( struct poster_job *job, int first, int npages,
+		       char *name, size_t size);
+static int cache_copy( struct poster_job *job, char *name,
+		       struct poster_sink *sink, struct poster_stats *stats);
+static int cache_create( struct poster_job *job, char *name, char *tmp, size_t size);
+static int sink_cachefill( void *handle, const char *buf, size_t n);
+static void cache_insert( struct poster_job *job, struct cachefill *fill,
+			  int r, char *tmp, char *name);
+static void cache_evict( struct poster_job *job);
+static int cmpused( const void *a, const void *b);
+static int dsc_infile( struct poster_job *job);
+static int dsc_comment( struct poster_job *job, char *buf,
+			int *level, int *dsc_cont, int *atend);
+static size_t dsc_trailer( struct poster_job *job, size_t from);
+static int dsc_pass( struct poster_job *job, char *line);
+static int postersize( struct poster_job *job);
+static int gridsize( struct poster_job *job, int grid[4]);
+static int rollsize( struct poster_job *job);
+static void rollseams( struct poster_job *job, int seams[2]);
+static int scalefactor( struct poster_job *job);
+static int posterbox( struct poster_job *job, double box[4]);
+static int lengthspec( struct poster_job *job, char *spec, double *len);
+static void placeposter( struct poster_job *job);
+static int imagebox( struct poster_job *job, struct poster_page *pg);
+struct planmedia;
+static int smallmedia( struct planmedia *pm, int n, double x, double y, double area);
+static int cmpplan( const void *a, const void *b);
+static long planbytes( struct poster_job *job, int ntiles);
+static int tilerange( char **pos, int lo, int hi, int *from, int *to);
+static int addtiles( struct poster_job *job, char *spec);
+static int imagelayout( struct poster_job *job, struct poster_page *pg);
+static int paging( struct poster_job *job);
+static void pagelayout( struct poster_job *job, struct poster_page *pg);
+static struct poster_page *tilepage( struct poster_job *job, int i);
+static int tilenumber( struct poster_job *job, int i);
+static void dsc_head1( struct poster_job *job, struct out *out);
+static void dsc_head2( struct poster_job *job, struct out *out, int npages);
+static void printposter( struct poster_job *job, struct out *out, int first, int npages);
+static void printprolog( struct poster_job *job, struct out *out);
+static void tile ( struct poster_job *job, struct out *out, struct poster_page *pg,
+		   int row, int col, int page, int ordinal);
+static void pagedefs( struct out *out, struct poster_page *pg);
+static void pagebegin( struct poster_job *job, struct out *out, struct poster_page *pg);
+static void pageend( struct poster_job *job, struct out *out);
+static long printfile( struct poster_job *job, struct out *out);
+static void findimage( struct poster_job *job);
+struct psitem;
+static void imagecall( struct poster_job *job, struct psitem *st, int sp,
+		       long seq, int color, double *ctm, size_t pos);
+static int pstoken( char *buf, size_t *pos, size_t end, size_t *tok);
+static void concat( double *ctm, double *m);
+static int cropping( struct poster_job *job);
+static int imagecrop( struct poster_job *job, int row, int col, int crop[4]);
+static int clampfloor( double x, int max);
+static int clampceil( double x, int max);
+static long printimage( struct poster_job *job, struct out *out, int row, int col);
+static long copyrange( struct poster_job *job, struct out *out, size_t from, size_t to);
+static long tilebytes( struct poster_job *job, int i);
+struct pdfval;
+struct pdfpage;
+struct pdfout;
+static int pdf_input( struct poster_job *job);
+static int pdf_read( struct poster_job *job);
+static int pdf_catalog( struct poster_job *job, struct pdfval *root);
+static int pdf_xref( struct poster_job *job);
+static int pdf_xreftable( struct poster_job *job, size_t off, long *prev);
+static int pdf_xrefstream( struct poster_job *job, size_t off, long *prev);
+static int pdf_trailer( struct poster_job *job, struct pdfval *t);
+static int pdf_rebuild( struct poster_job *job);
+static int pdf_objstm( struct poster_job *job, long stm, int enter);
+static int pdf_setxref( struct poster_pdf *pdf, long num, char type,
+			size_t off, int stm, int idx);
+static int pdf_object( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       long num, struct pdfval *v);
+static int pdf_resolve( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+			struct pdfval *v);
+static int pdf_get( struct pdfval *dict, char *key, struct pdfval *v);
+static int pdf_lookup( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       struct pdfval *dict, char *key, struct pdfval *v);
+static int pdf_getnum( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       struct pdfval *dict, char *key, long *x);
+static int pdf_real( struct pdfval *v, double *x);
+static int pdf_next( struct pdfval *arr, size_t *pos, struct pdfval *v);
+static int pdf_stream( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       struct pdfval *v, const char **data, size_t *len);
+static int pdf_decode( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       struct pdfval *v, char **out, size_t *outlen);
+static int pdf_inflate( const char *p, size_t n, char **out, size_t *outlen);
+static int pdf_predictor( char *data, size_t *len, long colors, long bpc,
+			  long columns);
+static int pdf_box( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		    struct pdfval *arr, double box[4]);
+static int pdf_pagetree( struct poster_job *job, long num, struct pdfpage *inherit,
+			 int depth);
+static void pdf_pagebox( struct pdfpage *pg, double bb[4], double m[6]);
+static void pdf_free( struct poster_pdf *pdf);
+static int pdf_output( struct poster_job *job, struct out *out, int first, int npages);
+static int pdf_form( struct poster_job *job, struct out *out, struct pdfout *po,
+		     struct pdfpage *pg, int n);
+static int pdf_tile( struct poster_job *job, struct out *out, struct pdfout *po,
+		     int form, double scale, double *imagebb, double *posterbb,
+		     int rotate, int row, int col, int page);
+static int pdf_newobj( struct pdfout *po);
+static void pdf_begin( struct out *out, struct pdfout *po, int n);
+static int pdf_renum( struct poster_job *job, struct pdfout *po, long num);
+static void pdf_copy( struct poster_job *job, struct out *out, struct pdfout *po,
+		      struct pdfval *v);
+static void pdf_copydict( struct poster_job *job, struct out *out, struct pdfout *po,
+			  struct pdfval *v, size_t length);
+static void pdf_flush( struct poster_job *job, struct out *out, struct pdfout *po);
+static void *splitworker( void *arg);
+static void *batchworker( void *arg);
+static void pdfname( char *name, size_t size);
+static double now( void);
+static void oprintf( struct out *out, char *fmt, ...);
+static void owrite( struct out *out, const char *p, size_t n);
+static void oflush( struct out *out);
+static int sink_file( void *handle, const char *buf, size_t n);
+static int sink_fd( void *handle, const char *buf, size_t n);
+static int sink_counted( void *handle, const char *buf, size_t n);
+static int sink_socket( void *handle, const char *buf, size_t n);
+static int sink_memory( void *handle, const char *buf, size_t n);
+static int sink_writer( void *handle, const char *buf, size_t n);
+static void writerswap( struct poster_writer *w);
+static int writererr( struct poster_writer *w);
+static void *writerthread( void *arg);
+static int outfile( struct poster_job *job, char *name, long size);
+static int closeout( int fd);
+static int sink_gzip( void *handle, const char *buf, size_t n);
+static void gzsubmit( struct poster_gzip *gz);
+static void gzdrain( struct poster_gzip *gz, int wait);
+static int gzbusy( struct poster_gzip *gz);
+static int gzerr( struct poster_gzip *gz);
+static void *gzworker( void *arg);
+static struct poster_mediadb *mediadb( struct poster_job *job);
+static void media_builtin( void);
+static int media_add( struct poster_mediadb *db, const char *name,
+		      double x, double y, int unit);
+static int media_node( struct poster_mediadb *db, int c);
+static int media_find( struct poster_mediadb *db, const char *spec);
+static int media_read( struct poster_job *job, struct poster_mediadb *db,
+		       char *file);
+static int media_load( struct poster_job *job, struct poster_mediadb *db,
+		       char *name, char *path, struct stat *st);
+static void media_save( struct poster_job *job, struct poster_mediadb *db,
+			char *name, char *path, struct stat *st);
+static int dbgrow( void *p, int *max, int n, size_t size);
+
+/* media sizes in ps units (1/72 inch): the built-in media database */
+static const struct {
+	char *name;
+	double size[2];
+	int unit;		/* a unit of measurement, not a media */
+} mediatable[] =
+{	{ "Letter",   { 612, 792}},
+	{ "Legal",    { 612, 1008}},
+	{ "Tabloid",  { 792, 1224}},
+	{ "Ledger",   { 792, 1224}},
+	{ "Executive",{ 540, 720}},
+	{ "Monarch",  { 279, 540}},
+	{ "Statement",{ 396, 612}},
+	{ "Folio",    { 612, 936}},
+	{ "Quarto",   { 610, 780}},
+	{ "C5",       { 459, 649}},
+	{ "B4",       { 729, 1032}},
+	{ "B5",       { 516, 729}},
+	{ "Dl",       { 312, 624}},
+	{ "A0",       { 2380, 3368}},
+	{ "A1",       { 1684, 2380}},
+	{ "A2",       { 1190, 1684}},
+	{ "A3",       { 842, 1190}},
+	{ "A4",       { 595, 842}},
+	{ "A5",       { 420, 595}},
+	{ "A6",       { 297, 421}},
+
+	/* as fall-back: linear units of measurement: */
+	{ "p",        { 1, 1}, 1},
+	{ "i",        { 72, 72}, 1},
+	{ "ft",       { 864, 864}, 1},
+	{ "mm",       { 2.83465, 2.83465}, 1},
+	{ "cm",       { 28.3465, 28.3465}, 1},
+	{ "m",        { 2834.65, 2834.65}, 1},
+	{ NULL}
+};
+
+/* the media database: media as numbers, and a trie of their lower */
+/* case names, for lookups by unique prefix; all in arrays indexed */
+/* by number, such that it can be kept in a file as it is */
+struct mediaentry {
+	double size[2];		/* in ps units */
+	int name;		/* offset in names */
+	int unit;
+};
+
+struct medianode {
+	int child, next;	/* first child and next sibling, 0 for none */
+	int entry;		/* the media of exactly this name, or -1 */
+	int count;		/* number of media with this prefix... */
+	int any;		/* ...and one of them */
+	int c;
+};
+
+struct poster_mediadb {
+	struct mediaentry *media;
+	int nmedia, maxmedia;
+	struct medianode *nodes;	/* [0] is the root */
+	int nnodes, maxnodes;
+	char *names;
+	int namelen, namealloc;
+};
+
+static struct poster_mediadb builtin;	/* made once, from mediatable */
+static pthread_once_t builtin_once = PTHREAD_ONCE_INIT;
+
+
+void poster_init( struct poster_job *job)
+{
+	memset( job, 0, sizeof( *job));
+	/* the defaults are the texts usage() shows, so read them as such */
+	poster_size_convert( job, DefaultSpillSize, &job->spillsize);
+	poster_size_convert( job, DefaultWriteSize, &job->writesize);
+	poster_size_convert( job, DefaultCacheSize, &job->cachesize);
+	job->maxsheets = atoi( DefaultMaxSheets);
+	job->creator = "poster";
+}
+
+void poster_free( struct poster_job *job)
+{
+	if (job->inmapped)
+		munmap( job->inbuf, job->insize);
+	else if (job->inbuf && job->inbuf != job->indata && job->insize)
+		free( job->inbuf);
+	job->inbuf = NULL;
+	job->inmapped = 0;
+	free( job->spans);
+	job->spans = NULL;
+	job->nspans = job->maxspans = 0;
+	free( job->dsclines);
+	job->dsclines = NULL;
+	job->dsclen = job->dscalloc = 0;
+	free( job->tiles);
+	job->tiles = NULL;
+	job->ntiles = 0;
+	free( job->pages);
+	job->pages = NULL;
+	job->npages = job->maxpages = 0;
+	free( job->resources);
+	job->resources = NULL;
+	job->nresources = job->maxresources = 0;
+	pdf_free( job->pdf);
+	job->pdf = NULL;
+	free( job->stats.tilebytes);
+	job->stats.tilebytes = NULL;
+}
+
+static int fail( struct poster_job *job, char *fmt, ...)
+{
+	va_list ap;
+
+	va_start( ap, fmt);
+	vsnprintf( job->errmsg, POSTER_MSGSIZE, fmt, ap);
+	va_end( ap);
+	return -1;
+}
+
+static void note( struct poster_job *job, int level, char *fmt, ...)
+{
+	va_list ap;
+
+	if (!job->log || job->verbose < level) return;
+	va_start( ap, fmt);
+	vfprintf( job->log, fmt, ap);
+	va_end( ap);
+}
+
+/*********************************************/
+/* decide on media size and margins          */
+/*********************************************/
+int poster_media( struct poster_job *job)
+{
+	if (job->scalespec && job->posterspec)
+		return fail( job, "Please don't specify both -s and -p!");
+	if (job->rollspec && job->pagemode)
+		return fail( job, "Please don't specify both -R and -P!");
+
+	/*** decide on media size ***/
+	if (!job->mediaspec)
+	{	job->mediaspec = DefaultMedia;
+		note( job, 1, "Using default media of %s\n", job->mediaspec);
+	}
+	if (poster_box_convert( job, job->mediaspec, job->mediasize) < 0)
+		return -1;
+	if (job->mediasize[3] < job->mediasize[2])
+		return fail( job, "Media should always be specified in portrait format!");
+	if (job->mediasize[2]-job->mediasize[0] <= 10.0 ||
+	    job->mediasize[3]-job->mediasize[1] <= 10.0)
+		return fail( job, "Media size is ridiculous!");
+
+	/*** defaulting poster size ? **/
+	if (!job->scalespec && !job->posterspec)
+	{	/* inherit postersize from given media size */
+		job->posterspec = job->mediaspec;
+		note( job, 1, "Defaulting poster size to media size of %s\n",
+			job->mediaspec);
+	}
+
+	/*** decide the cutmargin size, after knowing media size ***/
+	if (!job->cutmarginspec)
+	{	job->cutmarginspec = DefaultCutMargin;
+		note( job, 1, "Using default cutmargin of %s\n",
+			job->cutmarginspec);
+	}
+	if (poster_margin_convert( job, job->cutmarginspec, job->cutmargin) < 0)
+		return -1;
+
+	/*** decide the whitemargin size, after knowing media size ***/
+	if (!job->whitemarginspec)
+	{	job->whitemarginspec = DefaultWhiteMargin;
+		note( job, 1, "Using default whitemargin of %s\n",
+			job->whitemarginspec);
+	}
+	return poster_margin_convert( job, job->whitemarginspec, job->whitemargin);
+}
+
+/*********************************************/
+/* read the input, and find the picture size */
+/*********************************************/
+int poster_read( struct poster_job *job)
+{
+	double t0 = now();
+	int r = readinput( job);
+
+	/* the outputs in the cache go by the input contents */
+	if (r == 0 && job->cachedir)
+		job->inhash = fnv( 14695981039346656037ULL, job->inbuf, job->insize);
+	job->stats.scantime += now() - t0;
+	return r;
+}
+
+static int readinput( struct poster_job *job)
+{
+	/* map the input once, all further reading is done in memory */
+	if (loadfile( job) < 0)
+		return -1;
+	/* a PDF has its own structure, and gives PDF output */
+	if (pdf_input( job))
+		return pdf_read( job);
+
+	/* maybe an earlier run has scanned this very file already */
+	if (job->indexdir && job->inregular)
+	{	int r = index_load( job);
+		if (r < 0)
+			return r;
+		if (r == 0)
+			goto scanned;
+	}
+
+	/* keep input DSC lines for output, get BoundingBox spec if there */
+	if (dsc_infile( job) < 0)
+		return -1;
+
+	/* find what to copy into each tile */
+	if (scanbody( job) < 0)
+		return -1;
+	/* it may be a single image, that tiles can crop */
+	findimage( job);
+
+	if (job->indexdir && job->inregular)
+		index_save( job);
+scanned:
+	/* what the tiles copy no longer, with the resources sent once */
+	job->resbytes = 0;
+	if (hoisting( job))
+		job->resbytes = job->bodysize - copyrange( job, NULL, 0, job->insize);
+	return 0;
+}
+
+/* only the header, for planning */
+int poster_readheader( struct poster_job *job)
+{
+	double t0 = now();
+	int r = loadfile( job);
+
+	if (r == 0)
+		r = pdf_input( job) ? pdf_read( job) : dsc_infile( job);
+	job->stats.scantime += now() - t0;
+	return r;
+}
+
+/*********************************************/
+/* decide the input image bounding box, and  */
+/* from it the scale factor and poster size  */
+/*********************************************/
+int poster_layout( struct poster_job *job)
+{
+	double t0 = now();
+	int r;
+
+	if (job->strict && job->pdf)
+		return fail( job, "-S is for PostScript: the pages of PDF output "
+			"are independent already!");
+	r = makelayout( job);
+
+	/* room to count the output of every tile, when asked for */
+	free( job->stats.tilebytes);
+	job->stats.tilebytes = NULL;
+	if (r == 0 && job->tilestats &&
+	    !(job->stats.tilebytes = calloc( job->ntiles + 1, sizeof( long))))
+		r = fail( job, "Out of memory!");
+	job->stats.layouttime += now() - t0;
+	return r;
+}
+
+static int makelayout( struct poster_job *job)
+{
+	struct poster_page *pg;
+	int p;
+
+	if (!paging( job))
+	{	if (imagelayout( job, NULL) < 0)
+			return -1;
+		/*** decide which of the tiles to print ***/
+		return poster_tiles_convert( job, job->tilespec);
+	}
+
+	/* every page by itself, with its own tiles */
+	if (job->formmode)
+	{	note( job, 1, "Tiling page by page, ignoring -F\n");
+		job->formmode = 0;
+	}
+	free( job->tiles);
+	job->tiles = NULL;
+	job->ntiles = 0;
+	for (p = 0; p < job->npages; p++)
+	{	pg = job->pages + p;
+		note( job, 2, "   Page %d:\n", p+1);
+		if (imagelayout( job, pg) < 0)
+			return -1;
+		memcpy( pg->imagebb, job->imagebb, sizeof( pg->imagebb));
+		memcpy( pg->posterbb, job->posterbb, sizeof( pg->posterbb));
+		pg->scale = job->scale;
+		pg->rotate = job->rotate;
+		pg->nrows = job->nrows;
+		pg->ncols = job->ncols;
+		pg->first = job->ntiles;
+		if (addtiles( job, job->tilespec) < 0)
+			return -1;
+	}
+	pagelayout( job, job->pages);
+	note( job, 1, "Printing %d page%s of input on %d tiles\n",
+		job->npages, job->npages==1?"":"s", job->ntiles);
+	return 0;
+}
+
+/* the layout of the input (or of its page pg) */
+static int imagelayout( struct poster_job *job, struct poster_page *pg)
+{
+	/*** decide on the scale factor and poster size ***/
+	if (imagebox( job, pg) < 0 || postersize( job) < 0)
+		return -1;
+
+	note( job, 2, "   Output image is: [%g,%g,%g,%g]\n",
+		job->posterbb[0], job->posterbb[1],
+		job->posterbb[2], job->posterbb[3]);
+	return 0;
+}
+
+/* decide the input image bounding box */
+static int imagebox( struct poster_job *job, struct poster_page *pg)
+{
+	double *imagebb = job->imagebb;
+	char *spec = job->imagespec;
+
+	/**** decide the input image bounding box ****/
+	if (!spec && !job->got_bb && !(pg && pg->got_bb))
+	{	spec = DefaultImage;
+		note( job, 1, "Using default input image of %s\n", spec);
+	}
+	if (spec)
+	{	if (poster_box_convert( job, spec, imagebb) < 0)
+			return -1;
+	} else if (pg && pg->got_bb)
+		memcpy( imagebb, pg->bb, sizeof( pg->bb));
+	else
+		memcpy( imagebb, job->ps_bb, sizeof( job->ps_bb));
+
+	note( job, 2, "   Input image is: [%g,%g,%g,%g]\n",
+		imagebb[0], imagebb[1], imagebb[2], imagebb[3]);
+
+	if (imagebb[2]-imagebb[0] <= 0.0 || imagebb[3]-imagebb[1] <= 0.0)
+		return fail( job, "Input image should have positive size!");
+	return 0;
+}
+
+/* are the pages of the input tiled one by one? */
+static int paging( struct poster_job *job)
+{
+	return job->pagemode && job->npages > 0;
+}
+
+/* make the layout of page pg that of the job */
+static void pagelayout( struct poster_job *job, struct poster_page *pg)
+{
+	memcpy( job->imagebb, pg->imagebb, sizeof( pg->imagebb));
+	memcpy( job->posterbb, pg->posterbb, sizeof( pg->posterbb));
+	job->scale = pg->scale;
+	job->rotate = pg->rotate;
+	job->nrows = pg->nrows;
+	job->ncols = pg->ncols;
+}
+
+/* the page of tile i of tiles[] */
+static struct poster_page *tilepage( struct poster_job *job, int i)
+{
+	int lo = 0, hi = job->npages - 1, m;
+
+	while (lo < hi)
+	{	m = (lo + hi + 1) / 2;
+		if (job->pages[m].first <= i)
+			lo = m;
+		else	hi = m - 1;
+	}
+	return job->pages + lo;
+}
+
+/* the number (row*ncols+col in its layout) of tile i of tiles[] */
+static int tilenumber( struct poster_job *job, int i)
+{
+	if (job->tiles)
+		return job->tiles[i];
+	return paging( job) ? i - tilepage( job, i)->first : i;
+}
+
+/*********************************************/
+/* select the tiles to print:                */
+/* a comma separated list of page numbers    */
+/* (as in %%Page) or ranges of them, like    */
+/* '3,5-7', and/or of row:col ranges, like   */
+/* '2:1-3' or '1-2:*'. No spec means all.    */
+/* The tiles are printed in row order.       */
+/*********************************************/
+int poster_tiles_convert( struct poster_job *job, char *spec)
+{
+	free( job->tiles);
+	job->tiles = NULL;
+	job->ntiles = 0;
+	return addtiles( job, spec);
+}
+
+/* add the tiles selected by spec, of the current layout, to tiles[]; */
+/* all of them need no list: tiles[] stays NULL */
+static int addtiles( struct poster_job *job, char *spec)
+{
+	int n = job->nrows * job->ncols, i, r, c, *t, ntiles = job->ntiles;
+	int r0, r1, c0, c1, all, bad = 0;
+	char *sel, *p = NULL;
+
+	if (!spec && !job->tiles)
+	{	job->ntiles += n;
+		return 0;
+	}
+	if (!(t = realloc( job->tiles, (ntiles + n) * sizeof( int))))
+		return fail( job, "Out of memory!");
+	job->tiles = t;
+	if (!(sel = calloc( n, 1)))
+		return fail( job, "Out of memory!");
+
+	if (!spec)
+		memset( sel, 1, n);
+	else for (p = spec, bad = 0; !bad; p++)
+	{	all = *p == '*';
+		if (tilerange( &p, 1, n, &r0, &r1) < 0)
+			bad = 1;
+		else if (*p == ':')
+		{	/* row:col */
+			p++;
+			if (all)
+				r1 = job->nrows;
+			if (r1 > job->nrows ||
+			    tilerange( &p, 1, job->ncols, &c0, &c1) < 0 ||
+			    c1 > job->ncols)
+				bad = 1;
+			else for (r = r0; r <= r1; r++)
+				for (c = c0; c <= c1; c++)
+					sel[ (r-1)*job->ncols + c-1] = 1;
+		} else if (r1 > n)
+			bad = 1;
+		else	/* page numbers */
+			for (i = r0; i <= r1; i++)
+				sel[i-1] = 1;
+		if (*p != ',')
+			break;
+	}
+	if (spec && (bad || *p))
+	{	free( sel);
+		return fail( job, "Invalid tile selection '%s' for %d rows of %d tiles!",
+			spec, job->nrows, job->ncols);
+	}
+
+	for (i = 0; i < n; i++)
+		if (sel[i])
+			job->tiles[ job->ntiles++] = i;
+	free( sel);
+	if (job->ntiles == ntiles)
+		return fail( job, "No tiles selected by '%s'!", spec);
+	if (job->ntiles - ntiles < n)
+		note( job, 1, "Printing %d of the %d tiles\n", job->ntiles - ntiles, n);
+	return 0;
+}
+
+/* a number or range 'a-b' at *pos, '*' for [lo,hi] */
+static int tilerange( char **pos, int lo, int hi, int *from, int *to)
+{
+	char *p = *pos;
+
+	if (*p == '*')
+	{	*from = lo;
+		*to = hi;
+		*pos = p+1;
+		return 0;
+	}
+	if (!isdigit( (unsigned char)*p))
+		return -1;
+	*from = *to = strtol( p, &p, 10);
+	if (*p == '-')
+	{	if (!isdigit( (unsigned char)p[1]))
+			return -1;
+		*to = strtol( p+1, &p, 10);
+	}
+	*pos = p;
+	return *from < lo || *to < *from ? -1 : 0;
+}
+
+/*********************************************/
+/* write the poster into one document        */
+/*********************************************/
+int poster_output( struct poster_job *job, struct poster_sink *sink,
+		   int first, int npages)
+{
+	return output( job, sink, first, npages, &job->stats);
+}
+
+/* the same, adding its figures to stats; from the cache if it can */
+static int output( struct poster_job *job, struct poster_sink *sink,
+		   int first, int npages, struct poster_stats *stats)
+{
+	char name[PATH_MAX], tmp[PATH_MAX+8];
+	struct cachefill fill;
+	struct poster_sink fillsink;
+	int r;
+
+	if (!job->cachedir ||
+	    cache_name( job, first, npages, name, sizeof( name)) < 0)
+		return makeoutput( job, sink, first, npages, stats);
+	if ((r = cache_copy( job, name, sink, stats)) <= 0)
+		return r;
+
+	/* not there yet: keep a copy on the way to the sink */
+	if ((fill.fd = cache_create( job, name, tmp, sizeof( tmp))) < 0)
+		return makeoutput( job, sink, first, npages, stats);
+	fill.sink = sink;
+	fill.err = 0;
+	fillsink.write = sink_cachefill;
+	fillsink.handle = &fill;
+	r = makeoutput( job, &fillsink, first, npages, stats);
+	cache_insert( job, &fill, r, tmp, name);
+	return r;
+}
+
+static int makeoutput( struct poster_job *job, struct poster_sink *sink,
+		       int first, int npages, struct poster_stats *stats)
+{
+	struct out out;
+	struct poster_gzip *gz = NULL;
+	struct poster_writer *w = NULL;
+	struct poster_sink gzsink, countsink, wsink;
+	struct counted counted;
+	double t0 = now();
+	int r = 0;
+
+	if (job->writesize)
+	{	/* the sink writes on its own, while we go on */
+		if (!(w = poster_writer_open( &wsink, sink, job->writesize)))
+			return fail( job, "Out of memory!");
+		sink = &wsink;
+	}
+	counted.sink = sink;
+	counted.count = 0;
+	countsink.write = sink_counted;
+	countsink.handle = &counted;
+	out.job = job;
+	out.sink = &countsink;
+	out.len = 0;
+	out.done = 0;
+	out.err = 0;
+	out.stats = stats;
+	out.tilestart = t0;
+	if (!(out.buf = malloc( OUTBUFSIZE)))
+	{	if (w) poster_writer_close( w);
+		return fail( job, "Out of memory!");
+	}
+	if (job->gzlevel)
+	{	/* compress on the way to the sink */
+		if (!(gz = poster_gzip_open( &gzsink, &countsink, job->gzlevel,
+					     job->gzthreads)))
+		{	free( out.buf);
+			if (w) poster_writer_close( w);
+			return fail( job, "Cannot start compression!");
+		}
+		out.sink = &gzsink;
+	}
+
+	if (job->pdf)
+		r = pdf_output( job, &out, first, npages);
+	else
+	{	dsc_head1( job, &out);
+		dsc_head2( job, &out, npages);
+		printposter( job, &out, first, npages);
+	}
+	oflush( &out);
+	free( out.buf);
+	if (gz && poster_gzip_close( gz) < 0)
+		out.err = 1;
+	if (w && poster_writer_close( w) < 0)
+		out.err = 1;
+
+	stats->prologtime += out.tilestart - t0;
+	stats->tiletime += now() - out.tilestart;
+	stats->outbytes += out.done;
+	stats->sinkbytes += counted.count;
+	if (r < 0)
+		return -1;
+	if (out.err)
+		return fail( job, "Write error on output!");
+	return 0;
+}
+
+/* the header and prolog, and the tiles as estimated for a balanced split */
+long poster_outsize( struct poster_job *job, int first, int npages)
+{
+	long size = 4096 + job->dsclen;
+	int i;
+
+	if (job->pdf)
+		size += job->insize;	/* about all of it, as forms */
+	else if (job->formmode)
+		size += printfile( job, NULL);
+	else if (paging( job))
+		size += job->pages[0].off + (job->insize - job->trailer);
+	for (i = first; i < first + npages; i++)
+		size += tilebytes( job, i);
+	return size;
+}
+
+int poster_run( struct poster_job *job, struct poster_sink *sink)
+{
+	if (poster_media( job) < 0 || poster_read( job) < 0 ||
+	    poster_layout( job) < 0)
+		return -1;
+	return poster_output( job, sink, 0, job->ntiles);
+}
+
+/*********************************************/
+/* the figures of a job, for monitoring      */
+/*********************************************/
+int poster_stats_json( struct poster_job *job, FILE *fp)
+{
+	struct poster_stats *st = &job->stats;
+	struct poster_page *pg;
+	int i, t, ncols;
+
+	fprintf( fp, "{\n  \"input\": ");
+	jsonstr( fp, job->inname ? job->inname : "");
+	fprintf( fp, ",\n  \"input_bytes\": %lu,\n"
+		"  \"input_opens\": %d,\n  \"input_reads\": %ld,\n"
+		"  \"input_mapped\": %s,\n"
+		"  \"output_bytes\": %.0f,\n  \"sink_bytes\": %.0f,\n"
+		"  \"cached\": %s,\n",
+		(unsigned long)job->insize, st->nopens, st->nreads,
+		job->inmapped ? "true" : "false", st->outbytes, st->sinkbytes,
+		st->cached ? "true" : "false");
+	fprintf( fp, "  \"seconds\": { \"scan\": %.6f, \"layout\": %.6f, "
+		"\"prolog\": %.6f, \"tiles\": %.6f },\n",
+		st->scantime, st->layouttime, st->prologtime, st->tiletime);
+	fprintf( fp, "  \"format\": \"%s\",\n  \"media\": [%g, %g],\n",
+		job->pdf ? "pdf" : "ps", job->sheetsize[2], job->sheetsize[3]);
+
+	/* the layout: of the job, or of every page by itself */
+	if (!paging( job))
+		fprintf( fp, "  \"scale\": %.6f, \"rotate\": %d, "
+			"\"rows\": %d, \"cols\": %d,\n",
+			job->scale, job->rotate ? 90 : 0, job->nrows, job->ncols);
+	else
+	{	fprintf( fp, "  \"pages\": [");
+		for (i = 0; i < job->npages; i++)
+		{	pg = job->pages + i;
+			fprintf( fp, "%s\n    { \"page\": %d, \"scale\": %.6f, "
+				"\"rotate\": %d, \"rows\": %d, \"cols\": %d }",
+				i ? "," : "", i+1, pg->scale, pg->rotate ? 90 : 0,
+				pg->nrows, pg->ncols);
+		}
+		fprintf( fp, "\n  ],\n");
+	}
+
+	/* the output of each tile, as numbered on the sheets */
+	fprintf( fp, "  \"tiles\": [");
+	for (i = 0; i < job->ntiles; i++)
+	{	t = tilenumber( job, i);
+		pg = paging( job) ? tilepage( job, i) : NULL;
+		ncols = pg ? pg->ncols : job->ncols;
+		fprintf( fp, "%s\n    { ", i ? "," : "");
+		if (pg)
+			fprintf( fp, "\"page\": %d, ", (int)(pg - job->pages) + 1);
+		fprintf( fp, "\"tile\": %d, \"row\": %d, \"col\": %d, \"bytes\": %ld }",
+			t+1, t/ncols + 1, t%ncols + 1,
+			st->tilebytes ? st->tilebytes[i] : 0L);
+	}
+	fprintf( fp, "%s]\n}\n", job->ntiles ? "\n  " : "");
+	return ferror( fp) ? -1 : 0;
+}
+
+/* s as a JSON string */
+static void jsonstr( FILE *fp, const char *s)
+{
+	putc( '"', fp);
+	for (; *s; s++)
+		if (*s == '"' || *s == '\\')
+			fprintf( fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf( fp, "\\u%04x", (unsigned char)*s);
+		else
+			putc( *s, fp);
+	putc( '"', fp);
+}
+
+#define exch( x, y)	{double h; h=x; x=y; y=h;}
+
+/* a poster spec is met when the sheets cover this much of it: */
+/* one row or column less, at the price of a slightly smaller poster */
+#define PosterFit 0.95
+/* more sheets than any -L could mean, and than an int can count safely */
+#define MaxTiles 1e8
+
+static int postersize( struct poster_job *job)
+{	/* exactly one of scalespec and posterspec is NULL ! */
+	/* media and image sizes are fixed already */
+	int grid[4];
+
+	if (job->rollspec)
+	{	if (rollsize( job) < 0)
+			return -1;
+	} else
+	{	if (gridsize( job, grid) < 0)
+			return -1;
+		memcpy( job->sheetsize, job->mediasize, sizeof( job->sheetsize));
+		memcpy( job->sheetmargin, job->cutmargin, sizeof( job->sheetmargin));
+
+		/* decide for rotation to get the minimum page count */
+		job->rotate = (double)grid[0]*grid[1] > (double)grid[2]*grid[3];
+
+		job->ncols = job->rotate ? grid[2] : grid[0];
+		job->nrows = job->rotate ? grid[3] : grid[1];
+	}
+
+	note( job, 1, "Deciding for %d column%s and %d row%s of %s pages.\n",
+		job->ncols, (job->ncols==1)?"":"s",
+		job->nrows, (job->nrows==1)?"":"s",
+		job->rotate?"landscape":"portrait");
+
+	if (job->maxsheets > 0 && (double)job->nrows * job->ncols > job->maxsheets)
+		return fail( job, "However %dx%d pages is more than the limit "
+			"of %d (see -L)!", job->ncols, job->nrows, job->maxsheets);
+
+	placeposter( job);
+	return 0;
+}
+
+/* the columns and rows of sheets without rotation (grid[0], grid[1]) */
+/* and with it (grid[2], grid[3]); a scalespec sets the scale already */
+static int gridsize( struct poster_job *job, int grid[4])
+{
+	double sizex, sizey;    /* size of the scaled image in ps units */
+	double drawablex, drawabley; /* effective drawable size of media */
+	double tmpposter[4];
+	double g[4];		/* grid, before it is known to fit an int */
+	double *mediasize = job->mediasize;
+	double *imagebb = job->imagebb;
+	double *whitemargin = job->whitemargin;
+	int i;
+
+	/* available drawing area per sheet: */
+	drawablex = mediasize[2] - 2.0*job->cutmargin[0];
+	drawabley = mediasize[3] - 2.0*job->cutmargin[1];
+
+	/*** decide on number of pages  ***/
+	if (job->scalespec)
+	{	/* user specified scale factor */
+		if (scalefactor( job) < 0)
+			return -1;
+		sizex = (imagebb[2] - imagebb[0]) * job->scale + 2*whitemargin[0];
+		sizey = (imagebb[3] - imagebb[1]) * job->scale + 2*whitemargin[1];
+
+		/* without rotation */
+		g[0] = ceil( sizex / drawablex);
+		g[1] = ceil( sizey / drawabley);
+
+		/* with rotation */
+		g[2] = ceil( sizex / drawabley);
+		g[3] = ceil( sizey / drawablex);
+
+	} else
+	{	/* user specified output size */
+		if (posterbox( job, tmpposter) < 0)
+			return -1;
+
+		/* without rotation */ /* assuming tmpposter[0],[1] = 0,0 */
+		g[0] = ceil( PosterFit * tmpposter[2] / mediasize[2]);
+		g[1] = ceil( PosterFit * tmpposter[3] / mediasize[3]);
+
+		/* with rotation */
+		g[2] = ceil( PosterFit * tmpposter[2] / mediasize[3]);
+		g[3] = ceil( PosterFit * tmpposter[3] / mediasize[2]);
+		/* (rotation is considered as media versus image, which is totally */
+		/*  independent of the portrait or landscape style of the final poster) */
+	}
+
+	i = g[0]*g[1] > MaxTiles ? 0 : 2;	/* the grid that is too large */
+	if (g[i]*g[i+1] > MaxTiles)
+		return fail( job, "However %.0fx%.0f pages seems ridiculous to me!",
+			g[i], g[i+1]);
+	for (i = 0; i < 4; i++)
+		grid[i] = g[i];
+	return 0;
+}
+
+
+/* the -s scale factor */
+static int scalefactor( struct poster_job *job)
+{
+	job->scale = atof( job->scalespec);
+	if (job->scale < 0.01 || job->scale > 1.0e6)
+		return fail( job, "Illegal scale value %s!", job->scalespec);
+	return 0;
+}
+
+/* the -p poster size, turned the way the image is */
+static int posterbox( struct poster_job *job, double box[4])
+{
+	double *imagebb = job->imagebb;
+
+	if (poster_box_convert( job, job->posterspec, box) < 0)
+		return -1;
+	if (box[0]!=0.0 || box[1]!=0.0)
+	{	note( job, 0, "Poster lower-left coordinates are assumed 0!\n");
+		box[0] = box[1] = 0.0;
+	}
+	if (box[2]-box[0] <= 0.0 || box[3]-box[1] <= 0.0)
+		return fail( job, "Poster should have positive size!");
+
+	if ((box[3]-box[1]) < (box[2]-box[0]))
+	{	/* hmmm... landscape spec, change to portrait for now */
+		exch( box[0], box[1]);
+		exch( box[2], box[3]);
+	}
+
+	/* Should we tilt the poster to landscape style? */
+	if ((imagebb[3] - imagebb[1]) < (imagebb[2] - imagebb[0]))
+	{	/* image has landscape format ==> make landscape poster */
+		exch( box[0], box[1]);
+		exch( box[2], box[3]);
+	}
+	return 0;
+}
+
+/*********************************************/
+/* on a roll only the media width is fixed:  */
+/* the poster goes on strips across it, each */
+/* as long as the poster, or cut in pieces   */
+/* of at most the -R length. Margins and cut */
+/* lines are only where the pieces meet.     */
+/* The pieces become the sheets of the job;  */
+/* its media and margins stay as they are.   */
+/*********************************************/
+static int rollsize( struct poster_job *job)
+{
+	double width = job->mediasize[2];	/* of the roll */
+	double *cutmargin = job->cutmargin;
+	double *whitemargin = job->whitemargin;
+	double *imagebb = job->imagebb;
+	double size[2], box[4], maxlen = 0.0, across, along, len, n, m, s, t;
+	double best[4] = { 0, 0, 0, -1 };	/* rotate, strips, pieces, length; */
+						/* -1: none found yet */
+	int r;
+
+	if (lengthspec( job, job->rollspec, &maxlen) < 0)
+		return -1;
+	maxlen = floor( maxlen);
+	if (maxlen > 0 && maxlen - 2.0*cutmargin[1] <= 10.0)
+		return fail( job, "Roll length '%s' is ridiculous!", job->rollspec);
+	if (job->scalespec ? scalefactor( job) < 0 : posterbox( job, box) < 0)
+		return -1;
+	size[0] = imagebb[2] - imagebb[0];
+	size[1] = imagebb[3] - imagebb[1];
+
+	/* across the roll goes x of the poster, or y when rotated */
+	for (r = 0; r < 2; r++)
+	{	if (job->scalespec)
+		{	s = job->scale;
+			across = s * size[r] + 2*whitemargin[r];
+			n = across <= width ? 1 : ceil( across / (width - 2.0*cutmargin[0]));
+		} else
+		{	n = ceil( PosterFit * box[2+r] / width);
+			across = n == 1 ? width : n * (width - 2.0*cutmargin[0]);
+			s = (across - 2*whitemargin[r]) / size[r];
+			t = (box[3-r] - 2*whitemargin[!r]) / size[!r];
+			if (t < s)
+				s = t;
+		}
+		along = s * size[!r] + 2*whitemargin[!r];
+		if (maxlen <= 0 || along <= maxlen)
+		{	m = 1;
+			len = along;
+		} else
+		{	m = ceil( along / (maxlen - 2.0*cutmargin[1]));
+			len = along / m + 2.0*cutmargin[1];
+		}
+		len = ceil( len);
+		note( job, 2, "   %s: %.0f strip%s of %.0f piece%s %gp long\n",
+			r ? "Rotated" : "Upright", n, n==1?"":"s", m, m==1?"":"s", len);
+
+		/* of those that make sense (margins or whitemargins */
+		/* may eat all of the roll), the fewest pieces, then */
+		/* the least roll */
+		if (!(n >= 1 && m >= 1 && len > 0))
+			continue;
+		if (best[3] < 0 || n*m < best[1]*best[2] ||
+		    (n*m == best[1]*best[2] && n*m*len < best[1]*best[2]*best[3]))
+		{	best[0] = r;
+			best[1] = n;
+			best[2] = m;
+			best[3] = len;
+		}
+	}
+	if (best[3] < 0)
+		return fail( job, "The poster does not fit on the roll either way!");
+	if (best[1]*best[2] > MaxTiles)
+		return fail( job, "However %.0fx%.0f pieces seems ridiculous to me!",
+			best[1], best[2]);
+	if (best[3] <= 10.0 + (best[2] > 1 ? 2.0*cutmargin[1] : 0))
+		return fail( job, "Strip length of %gp is ridiculous!", best[3]);
+
+	job->rotate = best[0];
+	job->ncols = job->rotate ? best[2] : best[1];
+	job->nrows = job->rotate ? best[1] : best[2];
+	memcpy( job->sheetsize, job->mediasize, sizeof( job->sheetsize));
+	job->sheetsize[3] = best[3];
+	job->sheetmargin[0] = best[1] == 1 ? 0.0 : cutmargin[0];
+	job->sheetmargin[1] = best[2] == 1 ? 0.0 : cutmargin[1];
+	note( job, 1, "Deciding for %.0f strip%s of %.0f piece%s %gp long on the roll\n",
+		best[1], best[1]==1?"":"s", best[2], best[2]==1?"":"s", best[3]);
+	return 0;
+}
+
+/* on a roll: are there seams between strips (seams[0]) */
+/* and between the pieces of a strip (seams[1])? */
+static void rollseams( struct poster_job *job, int seams[2])
+{
+	seams[0] = (job->rotate ? job->nrows : job->ncols) > 1;
+	seams[1] = (job->rotate ? job->ncols : job->nrows) > 1;
+}
+
+/* a length: a number and a unit, like '3m', or the height */
+/* of a box, like 'A0'; '0' is none */
+static int lengthspec( struct poster_job *job, char *spec, double *len)
+{
+	double x = 1.0, box[4];
+	char *unit = spec;
+	int n = 0;
+
+	if (1==sscanf( spec, "%lf%n", &x, &n) && x==0.0 && n==strlen(spec))
+	{	*len = 0.0;
+		return 0;
+	}
+	if ((isdigit( spec[0]) || spec[0] == '.') && 1==sscanf( spec, "%lf%n", &x, &n) &&
+	    spec[n] != 'x' && spec[n] != '*')
+		unit += n;
+	else
+		x = 1.0;
+	if (!*unit)
+		return fail( job, "Length '%s' wants a unit, like '%sm'!", spec, spec);
+	if (poster_box_convert( job, unit, box) < 0)
+		return -1;
+	*len = x * box[3];
+	if (*len <= 0.0)
+		return fail( job, "Length '%s' should be positive!", spec);
+	return 0;
+}
+
+/* the scale and place of the poster, once the sheets are decided */
+static void placeposter( struct poster_job *job)
+{
+	double sizex, sizey;    /* size of the scaled image in ps units */
+	double drawablex, drawabley; /* effective drawable size of media */
+	double mediax, mediay;
+	double *imagebb = job->imagebb;
+	double *whitemargin = job->whitemargin;
+	double *posterbb = job->posterbb;
+
+	drawablex = job->sheetsize[2] - 2.0*job->sheetmargin[0];
+	drawabley = job->sheetsize[3] - 2.0*job->sheetmargin[1];
+	mediax = job->ncols * (job->rotate ? drawabley : drawablex);
+	mediay = job->nrows * (job->rotate ? drawablex : drawabley);
+
+	if (!job->scalespec)  /* no scaling number given by user */
+	{	double scalex, scaley;
+		scalex = (mediax - 2*whitemargin[0]) / (imagebb[2] - imagebb[0]);
+		scaley = (mediay - 2*whitemargin[1]) / (imagebb[3] - imagebb[1]);
+		job->scale = (scalex < scaley) ? scalex : scaley;
+
+		note( job, 1, "Deciding for a scale factor of %g\n", job->scale);
+		sizex = job->scale * (imagebb[2] - imagebb[0]);
+		sizey = job->scale * (imagebb[3] - imagebb[1]);
+	} else
+	{	sizex = (imagebb[2] - imagebb[0]) * job->scale + 2*whitemargin[0];
+		sizey = (imagebb[3] - imagebb[1]) * job->scale + 2*whitemargin[1];
+	}
+
+	/* set poster size as if it were a continuous surface without margins */
+	posterbb[0] = (mediax - sizex) / 2.0; /* center picture on paper */
+	posterbb[1] = (mediay - sizey) / 2.0; /* center picture on paper */
+	posterbb[2] = posterbb[0] + sizex;
+	posterbb[3] = posterbb[1] + sizey;
+}
+
+/*********************************************/
+/* plan: the layout on every media of the    */
+/* table, both ways, ranked by sheets used   */
+/*********************************************/
+#define SqMeter (0.0254/72 * 0.0254/72)	/* of a square ps unit */
+
+/* a media of the table, with the margins of the job on it */
+struct planmedia {
+	int ok;			/* the margins fit it */
+	double size[4], cutmargin[2], whitemargin[2];
+	double draw[2];		/* what is left to print on */
+};
+
+int poster_plan( struct poster_job *job, struct poster_plan *plans, int maxplans)
+{
+	struct poster_mediadb *db = mediadb( job);
+	struct mediaentry *e;
+	struct planmedia *pm, *m;
+	struct poster_plan *all, *pl;
+	struct poster_job j;
+	int n = db->nmedia, i, k, rot, grid[4], nplans = 0, c, r, fc, fr;
+	double w, h, a, ac, ar, colw, colh;
+
+	if (job->rollspec)
+		return fail( job, "Please don't specify both -R and -n!");
+	if (imagebox( job, NULL) < 0)
+		return -1;
+	pm = calloc( n, sizeof( *pm));
+	all = calloc( 2*n, sizeof( *all));
+	if (!pm || !all)
+	{	free( pm);
+		free( all);
+		return fail( job, "Out of memory!");
+	}
+
+	/* every size once, with its own margins (they may be in %) */
+	j = *job;
+	j.log = NULL;
+	for (i = 0; i < n; i++)
+	{	e = db->media + i;
+		for (k = 0; k < i && (db->media[k].size[0] != e->size[0] ||
+				      db->media[k].size[1] != e->size[1]); k++)
+			;
+		if (k < i || e->unit)
+			continue;
+		m = pm + i;
+		m->size[2] = e->size[0];
+		m->size[3] = e->size[1];
+		memcpy( j.mediasize, m->size, sizeof( m->size));
+		if (poster_margin_convert( &j, j.cutmarginspec, m->cutmargin) < 0 ||
+		    poster_margin_convert( &j, j.whitemarginspec, m->whitemargin) < 0)
+			continue;
+		m->draw[0] = m->size[2] - 2.0*m->cutmargin[0];
+		m->draw[1] = m->size[3] - 2.0*m->cutmargin[1];
+		m->ok = 1;
+	}
+
+	for (i = 0; i < n; i++)
+		for (rot = 0; rot < 2 && (m = pm + i)->ok; rot++)
+		{	j = *job;
+			j.log = NULL;
+			memcpy( j.mediasize, m->size, sizeof( m->size));
+			memcpy( j.cutmargin, m->cutmargin, sizeof( m->cutmargin));
+			memcpy( j.whitemargin, m->whitemargin, sizeof( m->whitemargin));
+			memcpy( j.sheetsize, m->size, sizeof( m->size));
+			memcpy( j.sheetmargin, m->cutmargin, sizeof( m->cutmargin));
+			if (gridsize( &j, grid) < 0)
+			{	/* the same for every media: a bad spec */
+				strcpy( job->errmsg, j.errmsg);
+				free( pm);
+				free( all);
+				return -1;
+			}
+			j.rotate = rot;
+			j.ncols = grid[2*rot];
+			j.nrows = grid[2*rot + 1];
+			if (j.maxsheets > 0 && (double)j.ncols * j.nrows > j.maxsheets)
+				continue;
+			placeposter( &j);
+
+			pl = all + nplans++;
+			snprintf( pl->media, sizeof( pl->media), "%s", db->names + db->media[i].name);
+			pl->mediasize[0] = m->size[2];
+			pl->mediasize[1] = m->size[3];
+			pl->rotate = rot;
+			pl->nrows = j.nrows;
+			pl->ncols = j.ncols;
+			pl->nsheets = j.nrows * j.ncols;
+			pl->scale = j.scale;
+			a = m->size[2] * m->size[3];
+			pl->paper = pl->nsheets * a * SqMeter;
+
+			/* with the poster against the first column and row, */
+			/* the last ones may need only a smaller sheet */
+			w = j.posterbb[2] - j.posterbb[0];
+			h = j.posterbb[3] - j.posterbb[1];
+			colw = m->draw[rot];
+			colh = m->draw[!rot];
+			fc = j.ncols > 1 ? smallmedia( pm, n, w - (j.ncols-1)*colw, colh, a) : -1;
+			fr = j.nrows > 1 ? smallmedia( pm, n, colw, h - (j.nrows-1)*colh, a) : -1;
+			ac = fc < 0 ? a : pm[fc].size[2] * pm[fc].size[3];
+			ar = fr < 0 ? a : pm[fr].size[2] * pm[fr].size[3];
+			c = j.ncols - (fc >= 0);
+			r = j.nrows - (fr >= 0);
+			pl->smallpaper = (c*r*a + (fc >= 0)*r*ac + (fr >= 0)*c*ar +
+				(fc >= 0 && fr >= 0)*(ac < ar ? ac : ar)) * SqMeter;
+			snprintf( pl->lastcol, sizeof( pl->lastcol), "%s",
+				fc < 0 ? "" : db->names + db->media[fc].name);
+			snprintf( pl->lastrow, sizeof( pl->lastrow), "%s",
+				fr < 0 ? "" : db->names + db->media[fr].name);
+			pl->waste = 1.0 - w*h*SqMeter / pl->smallpaper;
+			pl->bytes = planbytes( &j, pl->nsheets);
+		}
+
+	qsort( all, nplans, sizeof( *all), cmpplan);
+	if (maxplans > 0)
+		memcpy( plans, all, (nplans < maxplans ? nplans : maxplans) * sizeof( *all));
+	free( pm);
+	free( all);
+	return nplans;
+}
+
+/* the smallest media, less than area, that has room for x by y */
+static int smallmedia( struct planmedia *pm, int n, double x, double y, double area)
+{
+	int i, best = -1;
+	double a;
+
+	for (i = 0; i < n; i++)
+	{	a = pm[i].size[2] * pm[i].size[3];
+		if (pm[i].ok && a < area &&
+		    ((pm[i].draw[0] >= x && pm[i].draw[1] >= y) ||
+		     (pm[i].draw[1] >= x && pm[i].draw[0] >= y)))
+		{	area = a;
+			best = i;
+		}
+	}
+	return best;
+}
+
+/* fewest sheets first, then least paper; on a tie, portrait first */
+/* (as postersize() decides) */
+static int cmpplan( const void *a, const void *b)
+{
+	const struct poster_plan *p = a, *q = b;
+
+	if (p->nsheets != q->nsheets)
+		return p->nsheets < q->nsheets ? -1 : 1;
+	if (p->paper != q->paper)
+		return p->paper < q->paper ? -1 : 1;
+	if (p->rotate != q->rotate)
+		return p->rotate - q->rotate;
+	if (p->smallpaper != q->smallpaper)
+		return p->smallpaper < q->smallpaper ? -1 : 1;
+	return strcmp( p->media, q->media);
+}
+
+int poster_margin_convert( struct poster_job *job, char *spec, double margin[2])
+{	double x;
+	int i, n;
+
+	if (1==sscanf( spec, "%lf%n", &x, &n) && x==0.0 && n==strlen(spec))
+	{	/* margin spec of 0, dont bother about a otherwise mandatory unit */
+		margin[0] = margin[1] = 0.0;
+	} else if (spec[ strlen( spec) - 1] == '%')
+	{	/* margin relative to media size */
+		if (1 != sscanf( spec, "%lf%%", &x))
+			return fail( job, "Illegal margin specification!");
+		margin[0] = 0.01 * x * job->mediasize[2];
+		margin[1] = 0.01 * x * job->mediasize[3];
+	} else
+	{	/* absolute margin value */
+		double marg[4];
+		if (poster_box_convert( job, spec, marg) < 0)
+			return -1;
+		margin[0] = marg[2];
+		margin[1] = marg[3];
+	}
+
+	for (i=0; i<2; i++)
+	{	if (margin[i] < 0 || 2.0*margin[i] >= job->mediasize[i+2])
+			return fail( job, "Margin value '%s' out of range!", spec);
+	}
+	return 0;
+}
+
+int poster_box_convert( struct poster_job *job, char *boxspec, double psbox[4])
+{	/* convert user textual box spec into numbers in ps units */
+	/* box = [fixed x fixed][+ fixed , fixed] unit */
+	/* fixed = digits [ . digits] */
+	/* unit = medianame | i | cm | mm | m | p */
+
+	struct poster_mediadb *db;
+	double mx, my, ox, oy, ux, uy;
+	int n, r, i, inx;
+	char *spec;
+
+	mx = my = 1.0;
+	ox = oy = 0.0;
+
+	job->errbox = 1;
+	spec = boxspec;
+	/* read 'fixed x fixed' */
+	if (isdigit( spec[0]))
+	{	r = sscanf( spec, "%lfx%lf%n", &mx, &my, &n);
+		if (r != 2)
+		{	r = sscanf( spec, "%lf*%lf%n", &mx, &my, &n);
+			if (r != 2) goto boxerr;
+		}
+		spec += n;
+	}
+
+	/* read '+ fixed , fixed' */
+	if (1 < (r = sscanf( spec, "+%lf,%lf%n", &ox, &oy, &n)))
+	{	if (r != 2) goto boxerr;
+		spec += n;
+	}
+
+	/* read unit */
+	db = mediadb( job);
+	if ((inx = media_find( db, spec)) == -1) goto boxerr;
+	job->errbox = 0;
+	if (inx < 0)
+		return fail( job, "Your box spec '%s' is not unique! (give more chars)",
+			spec);
+	ux = db->media[inx].size[0];
+	uy = db->media[inx].size[1];
+
+	psbox[0] = ox * ux;
+	psbox[1] = oy * uy;
+	psbox[2] = mx * ux;
+	psbox[3] = my * uy;
+
+	note( job, 2, "   Box_convert: '%s' into [%g,%g,%g,%g]\n",
+		boxspec, psbox[0], psbox[1], psbox[2], psbox[3]);
+
+	for (i=0; i<2; i++)
+	{	if (psbox[i] < 0.0 || psbox[i+2] < psbox[i])
+			return fail( job, "Your specification `%s' leads to "
+				"negative values!", boxspec);
+	}
+	return 0;
+
+boxerr:
+	return fail( job, "I don't understand your box specification `%s'!",
+		boxspec);
+}
+
+void poster_boxhelp( struct poster_job *job, FILE *fp)
+{	struct poster_mediadb *db = mediadb( job);
+	int i;
+
+	fprintf( fp, "The proper format is: ([text] meaning optional text)\n");
+	fprintf( fp, "  [multiplier][offset]unit\n");
+	fprintf( fp, "  with multiplier:  numberxnumber\n");
+	fprintf( fp, "  with offset:      +number,number\n");
+	fprintf( fp, "  with unit one of:");
+
+	for (i=0; i < db->nmedia; i++)
+		fprintf( fp, "%c%-10s", (i%7)?' ':'\n', db->names + db->media[i].name);
+	fprintf( fp, "\nYou can use a shorthand for these unit names,\n"
+		"provided it resolves unique.\n");
+}
+
+/*********************************************/
+/* media database: the built-in table, with  */
+/* the media of a file added.  Lines of that */
+/* file are `name size [unit]', where size   */
+/* is `width,height' in ps units or a <box>  */
+/* of the media known so far, and `#' starts */
+/* a comment.  With indexdir, the parsed     */
+/* database is kept there for the next runs. */
+/*********************************************/
+#define MediaMagic "%!poster-media 1"
+
+struct poster_mediadb *poster_mediadb_load( struct poster_job *job, char *file)
+{
+	char path[PATH_MAX], name[PATH_MAX];
+	struct poster_mediadb *db;
+	struct stat st;
+	int i, n;
+
+	if (!(db = calloc( 1, sizeof( *db))))
+	{	fail( job, "Out of memory!");
+		return NULL;
+	}
+	if (stat( file, &st) < 0 || !realpath( file, path))
+	{	fail( job, "Cannot read media file '%s'!", file);
+		free( db);
+		return NULL;
+	}
+	name[0] = '\0';
+	if (job->indexdir)
+	{	n = snprintf( name, sizeof( name), "%s/%016llx.pmdb", job->indexdir,
+			fnv( 14695981039346656037ULL, path, strlen( path)));
+		if (n < 0 || (size_t)n >= sizeof( name))
+			name[0] = '\0';
+	}
+	if (name[0] && media_load( job, db, name, path, &st) == 0)
+		return db;
+
+	for (i = 0; mediatable[i].name; i++)
+		if (media_add( db, mediatable[i].name, mediatable[i].size[0],
+			       mediatable[i].size[1], mediatable[i].unit) < 0)
+		{	fail( job, "Out of memory!");
+			break;
+		}
+	if (mediatable[i].name || media_read( job, db, file) < 0)
+	{	poster_mediadb_free( db);
+		return NULL;
+	}
+	note( job, 1, "Read %d media from '%s'\n", db->nmedia - i, file);
+	if (name[0])
+		media_save( job, db, name, path, &st);
+	return db;
+}
+
+void poster_mediadb_free( struct poster_mediadb *db)
+{
+	if (!db)
+		return;
+	free( db->media);
+	free( db->nodes);
+	free( db->names);
+	free( db);
+}
+
+/* the media database of a job */
+static struct poster_mediadb *mediadb( struct poster_job *job)
+{
+	if (job->mediadb)
+		return job->mediadb;
+	pthread_once( &builtin_once, media_builtin);
+	return &builtin;
+}
+
+static void media_builtin( void)
+{
+	int i;
+
+	/* out of memory leaves the rest unknown, which shows as box errors */
+	for (i = 0; mediatable[i].name; i++)
+		if (media_add( &builtin, mediatable[i].name, mediatable[i].size[0],
+			       mediatable[i].size[1], mediatable[i].unit) < 0)
+			break;
+}
+
+/* add a media, or give a known name its new size */
+static int media_add( struct poster_mediadb *db, const char *name,
+		      double x, double y, int unit)
+{
+	struct mediaentry *e;
+	const char *c;
+	int i, n, len = strlen( name) + 1;
+
+	if (!db->nnodes && media_node( db, 0) < 0)
+		return -1;
+	for (n = 0, c = name; *c; c++)
+	{	for (i = db->nodes[n].child;
+		     i && db->nodes[i].c != tolower( (unsigned char)*c);
+		     i = db->nodes[i].next)
+			;
+		if (!i)
+		{	if ((i = media_node( db, tolower( (unsigned char)*c))) < 0)
+				return -1;
+			db->nodes[i].next = db->nodes[n].child;
+			db->nodes[n].child = i;
+		}
+		n = i;
+	}
+	if (dbgrow( &db->names, &db->namealloc, db->namelen + len, 1) < 0)
+		return -1;
+
+	if ((i = db->nodes[n].entry) < 0)
+	{	if (dbgrow( &db->media, &db->maxmedia, db->nmedia + 1,
+			    sizeof( struct mediaentry)) < 0)
+			return -1;
+		i = db->nodes[n].entry = db->nmedia++;
+		/* count it along its name */
+		for (n = 0, c = name; ; c++)
+		{	if (db->nodes[n].count++ == 0)
+				db->nodes[n].any = i;
+			if (!*c)
+				break;
+			for (n = db->nodes[n].child;
+			     db->nodes[n].c != tolower( (unsigned char)*c);
+			     n = db->nodes[n].next)
+				;
+		}
+	}
+	e = db->media + i;
+	e->size[0] = x;
+	e->size[1] = y;
+	e->unit = unit;
+	e->name = db->namelen;
+	memcpy( db->names + db->namelen, name, len);
+	db->namelen += len;
+	return 0;
+}
+
+/* a new trie node, without children */
+static int media_node( struct poster_mediadb *db, int c)
+{
+	struct medianode *nd;
+
+	if (dbgrow( &db->nodes, &db->maxnodes, db->nnodes + 1,
+		    sizeof( struct medianode)) < 0)
+		return -1;
+	nd = db->nodes + db->nnodes;
+	memset( nd, 0, sizeof( *nd));
+	nd->entry = -1;
+	nd->c = c;
+	return db->nnodes++;
+}
+
+/* the media named spec, or the only one it is a prefix of: */
+/* -1 for none, -2 when not unique */
+static int media_find( struct poster_mediadb *db, const char *spec)
+{
+	int n = 0, i;
+
+	if (!db->nnodes)
+		return -1;
+	for (; *spec; spec++)
+	{	for (i = db->nodes[n].child;
+		     i && db->nodes[i].c != tolower( (unsigned char)*spec);
+		     i = db->nodes[i].next)
+			;
+		if (!i)
+			return -1;
+		n = i;
+	}
+	if (db->nodes[n].entry >= 0)
+		return db->nodes[n].entry;
+	return db->nodes[n].count == 1 ? db->nodes[n].any :
+		db->nodes[n].count ? -2 : -1;
+}
+
+/* add the media of a file */
+static int media_read( struct poster_job *job, struct poster_mediadb *db,
+		       char *file)
+{
+	char buf[BUFSIZE], name[BUFSIZE], size[BUFSIZE], unit[BUFSIZE], *c;
+	struct poster_job j;
+	double box[4];
+	int line = 0, n, k;
+	FILE *fp;
+
+	if (!(fp = fopen( file, "r")))
+		return fail( job, "Cannot read media file '%s'!", file);
+	/* a size may name the media before it */
+	j = *job;
+	j.mediadb = db;
+	j.log = NULL;
+	while (fgets( buf, sizeof( buf), fp))
+	{	line++;
+		if ((c = strchr( buf, '#')))
+			*c = '\0';
+		n = sscanf( buf, "%s %s %s", name, size, unit);
+		if (n <= 0)
+			continue;
+		if (n < 2 || (n == 3 && strcmp( unit, "unit")) ||
+		    !isalpha( (unsigned char)name[0]))
+		{	fclose( fp);
+			return fail( job, "%s, line %d: expected `name size [unit]'",
+				file, line);
+		}
+		if (sscanf( size, "%lf,%lf%n", box+2, box+3, &k) != 2 ||
+		    size[k])
+		{	if (poster_box_convert( &j, size, box) < 0)
+			{	fclose( fp);
+				return fail( job, "%s, line %d: %s", file, line,
+					j.errmsg);
+			}
+		}
+		if (box[2] <= 0 || box[3] <= 0)
+		{	fclose( fp);
+			return fail( job, "%s, line %d: size should be positive",
+				file, line);
+		}
+		if (media_add( db, name, box[2], box[3], n == 3) < 0)
+		{	fclose( fp);
+			return fail( job, "Out of memory!");
+		}
+	}
+	fclose( fp);
+	return 0;
+}
+
+/* the database as kept for this very file; returns 0 when used, */
+/* 1 when not */
+static int media_load( struct poster_job *job, struct poster_mediadb *db,
+		       char *name, char *path, struct stat *st)
+{
+	char line[PATH_MAX], *c;
+	long dev, ino, size, mtime, mnsec, ctime, cnsec;
+	int nmedia, nnodes, namelen, i, ok;
+	struct medianode *nd;
+	FILE *fp;
+
+	if (!(fp = fopen( name, "r")))
+		return 1;
+	ok = fgets( line, PATH_MAX, fp) &&
+	     !strncmp( line, MediaMagic, strlen( MediaMagic)) &&
+	     fgets( line, PATH_MAX, fp) &&
+	     (c = strchr( line, '\n')) && (*c = '\0', !strcmp( line, path)) &&
+	     fgets( line, PATH_MAX, fp) &&
+	     sscanf( line, "%ld %ld %ld %ld.%ld %ld.%ld %d %d %d", &dev, &ino,
+		     &size, &mtime, &mnsec, &ctime, &cnsec, &nmedia, &nnodes,
+		     &namelen) == 10 &&
+	     dev == (long)st->st_dev && ino == (long)st->st_ino &&
+	     size == (long)st->st_size &&
+	     mtime == (long)st->st_mtim.tv_sec && mnsec == st->st_mtim.tv_nsec &&
+	     ctime == (long)st->st_ctim.tv_sec && cnsec == st->st_ctim.tv_nsec &&
+	     nmedia > 0 && nnodes > 0 && namelen > 0 &&
+	     dbgrow( &db->media, &db->maxmedia, nmedia, sizeof( struct mediaentry)) == 0 &&
+	     dbgrow( &db->nodes, &db->maxnodes, nnodes, sizeof( struct medianode)) == 0 &&
+	     dbgrow( &db->names, &db->namealloc, namelen, 1) == 0 &&
+	     fread( db->media, sizeof( struct mediaentry), nmedia, fp) == (size_t)nmedia &&
+	     fread( db->nodes, sizeof( struct medianode), nnodes, fp) == (size_t)nnodes &&
+	     fread( db->names, 1, namelen, fp) == (size_t)namelen &&
+	     db->names[namelen-1] == '\0';
+	fclose( fp);
+
+	/* all references stay inside the arrays */
+	for (i = 0; ok && i < nmedia; i++)
+		ok = db->media[i].name >= 0 && db->media[i].name < namelen;
+	for (i = 0; ok && i < nnodes; i++)
+	{	nd = db->nodes + i;
+		ok = nd->child >= 0 && nd->child < nnodes &&
+		     nd->next >= 0 && nd->next < nnodes &&
+		     nd->entry >= -1 && nd->entry < nmedia &&
+		     nd->any >= 0 && nd->any < nmedia;
+	}
+	if (!ok)
+	{	note( job, 1, "Media cache '%s' is out of date, reading again\n", name);
+		return 1;
+	}
+	db->nmedia = nmedia;
+	db->nnodes = nnodes;
+	db->namelen = namelen;
+	note( job, 1, "Using media of '%s' from cache '%s'\n", path, name);
+	return 0;
+}
+
+/* keep the database for the next runs; failures are not errors */
+static void media_save( struct poster_job *job, struct poster_mediadb *db,
+			char *name, char *path, struct stat *st)
+{
+	char tmp[PATH_MAX+8];
+	FILE *fp;
+	int fd;
+
+	snprintf( tmp, sizeof( tmp), "%s.XXXXXX", name);
+	if ((fd = mkstemp( tmp)) < 0)
+	{	note( job, 1, "Cannot create media cache '%s'\n", name);
+		return;
+	}
+	if (!(fp = fdopen( fd, "w")))
+	{	close( fd);
+		unlink( tmp);
+		return;
+	}
+	fprintf( fp, "%s\n%s\n", MediaMagic, path);
+	fprintf( fp, "%ld %ld %ld %ld.%09ld %ld.%09ld %d %d %d\n",
+		(long)st->st_dev, (long)st->st_ino, (long)st->st_size,
+		(long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec,
+		(long)st->st_ctim.tv_sec, (long)st->st_ctim.tv_nsec,
+		db->nmedia, db->nnodes, db->namelen);
+	fwrite( db->media, sizeof( struct mediaentry), db->nmedia, fp);
+	fwrite( db->nodes, sizeof( struct medianode), db->nnodes, fp);
+	fwrite( db->names, 1, db->namelen, fp);
+	if (fclose( fp) || rename( tmp, name) < 0)
+	{	note( job, 1, "Cannot write media cache '%s'\n", name);
+		unlink( tmp);
+		return;
+	}
+	note( job, 2, "   Media kept in cache '%s'\n", name);
+}
+
+/* room for n elements in the array at *p */
+static int dbgrow( void *p, int *max, int n, size_t size)
+{
+	void *q;
+	int m;
+
+	if (n <= *max)
+		return 0;
+	for (m = *max ? *max : 16; m < n; m *= 2)
+		;
+	if (!(q = realloc( *(void **)p, m * size)))
+		return -1;
+	*(void **)p = q;
+	*max = m;
+	return 0;
+}
+
+/* size like '4096', '64k', '16M' or '2G' */
+int poster_size_convert( struct poster_job *job, char *spec, size_t *size)
+{	double x;
+	char *c;
+
+	x = strtod( spec, &c);
+	switch (*c)
+	{ case 'k': case 'K': x *= 1024.0; c++; break;
+	  case 'm': case 'M': x *= 1024.0*1024.0; c++; break;
+	  case 'g': case 'G': x *= 1024.0*1024.0*1024.0; c++; break;
+	}
+	if (c == spec || *c || x < 0.0)
+		return fail( job, "Illegal size specification '%s'!", spec);
+	*size = (size_t)x;
+	return 0;
+}
+
+/*********************************************/
+/* read the complete input file into memory  */
+/*********************************************/
+static int loadfile( struct poster_job *job)
+{
+	struct stat st;
+	int fd, fromstdin;
+
+	if (job->indata)
+	{	/* caller has it in memory already */
+		job->inname = job->infile ? job->infile : "(data)";
+		job->inbuf = (char *)job->indata;
+		job->insize = job->inlen;
+		return 0;
+	}
+
+	fromstdin = !job->infile || !strcmp( job->infile, "-");
+	job->inname = fromstdin ? "(stdin)" : job->infile;
+
+	if ((fd = fromstdin ? 0 : open( job->infile, O_RDONLY)) < 0 ||
+	    fstat( fd, &st) < 0)
+		return fail( job, "fail to open file '%s'!", job->inname);
+	job->stats.nopens++;
+
+	if (!S_ISREG( st.st_mode))
+	{	/* a pipe: cannot map, cannot read twice */
+		int r = readstdin( job, fd);
+		if (!fromstdin) close( fd);
+		return r;
+	}
+
+	job->inregular = 1;
+	job->indev = st.st_dev;
+	job->inino = st.st_ino;
+	job->inmtime = st.st_mtim.tv_sec;
+	job->inmnsec = st.st_mtim.tv_nsec;
+	job->inctime = st.st_ctim.tv_sec;
+	job->incnsec = st.st_ctim.tv_nsec;
+	job->insize = st.st_size;
+	job->inbuf = "";
+	if (job->insize > 0 &&
+	    (job->inbuf = mmap( NULL, job->insize, PROT_READ, MAP_PRIVATE, fd, 0))
+		== MAP_FAILED)
+	{	/* cannot map (odd file system?), just read it */
+		size_t got;
+		ssize_t n;
+
+		if (!(job->inbuf = malloc( job->insize)))
+		{	if (!fromstdin) close( fd);
+			return fail( job, "no memory for file '%s'!", job->inname);
+		}
+		for (got = 0; got < job->insize; got += n)
+		{	n = read( fd, job->inbuf + got, job->insize - got);
+			job->stats.nreads++;
+			if (n < 0 && errno == EINTR) n = 0;
+			else if (n <= 0)
+			{	if (!fromstdin) close( fd);
+				return fail( job, "fail to read file '%s'!",
+					job->inname);
+			}
+		}
+	}
+	else if (job->insize > 0)
+	{	job->inmapped = 1;
+#ifdef MADV_SEQUENTIAL
+		madvise( job->inbuf, job->insize, MADV_SEQUENTIAL);
+#endif
+	}
+	if (!fromstdin) close( fd);
+	return 0;
+}
+
+/*********************************************/
+/* read a pipe exactly once: in memory while */
+/* small, spilled to a temp file when large  */
+/*********************************************/
+static int readstdin( struct poster_job *job, int fd)
+{
+	size_t alloc, insize;
+	ssize_t n;
+	int tmpfd = -1;
+	char *tmpdir, tmpname[BUFSIZE], *inbuf, *p;
+
+	alloc = 64 * 1024;
+	if (alloc > job->spillsize) alloc = job->spillsize;
+	if (alloc < 1) alloc = 1;
+	if (!(inbuf = malloc( alloc)))
+		return fail( job, "Out of memory!");
+
+	insize = 0;
+	for (;;)
+	{	if (insize == alloc)
+		{	if (tmpfd < 0 && alloc < job->spillsize)
+			{	/* still allowed to grow in memory */
+				alloc = (2*alloc < job->spillsize) ? 2*alloc : job->spillsize;
+				if (!(p = realloc( inbuf, alloc)))
+				{	free( inbuf);
+					return fail( job, "Out of memory!");
+				}
+				inbuf = p;
+			} else
+			{	/* too big: move it to a temp file */
+				if (tmpfd < 0)
+				{	if (!(tmpdir = getenv( "TMPDIR")))
+						tmpdir = "/tmp";
+					snprintf( tmpname, BUFSIZE,
+						"%s/posterXXXXXX", tmpdir);
+					if ((tmpfd = mkstemp( tmpname)) < 0)
+					{	free( inbuf);
+						return fail( job, "cannot create temp file '%s'!",
+							tmpname);
+					}
+					unlink( tmpname);
+					note( job, 1, "Input exceeds %lu bytes, spilling to temp file\n",
+						(unsigned long)job->spillsize);
+				}
+				if (write( tmpfd, inbuf, insize) != (ssize_t)insize)
+				{	free( inbuf);
+					close( tmpfd);
+					return fail( job, "write error on temp file!");
+				}
+				insize = 0;
+				if (alloc < 64 * 1024)
+				{	/* copy in decent chunks from now on */
+					alloc = 64 * 1024;
+					if (!(p = realloc( inbuf, alloc)))
+					{	free( inbuf);
+						close( tmpfd);
+						return fail( job, "Out of memory!");
+					}
+					inbuf = p;
+				}
+			}
+		}
+
+		n = read( fd, inbuf + insize, alloc - insize);
+		job->stats.nreads++;
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0)
+		{	free( inbuf);
+			if (tmpfd >= 0) close( tmpfd);
+			return fail( job, "fail to read file '%s'!", job->inname);
+		}
+		if (n == 0) break;
+		insize += n;
+	}
+
+	if (tmpfd >= 0)
+	{	/* flush the remainder, and map the temp file as input */
+		struct stat st;
+
+		if (write( tmpfd, inbuf, insize) != (ssize_t)insize ||
+		    fstat( tmpfd, &st) < 0)
+		{	free( inbuf);
+			close( tmpfd);
+			return fail( job, "write error on temp file!");
+		}
+		free( inbuf);
+		insize = st.st_size;
+		inbuf = mmap( NULL, insize, PROT_READ, MAP_PRIVATE, tmpfd, 0);
+		close( tmpfd);
+		if (inbuf == MAP_FAILED)
+			return fail( job, "cannot map temp file!");
+		job->inmapped = 1;
+	}
+	else if (insize == 0)
+	{	free( inbuf);
+		inbuf = "";
+	}
+	job->inbuf = inbuf;
+	job->insize = insize;
+	return 0;
+}
+
+/*********************************************/
+/* get the next input line from *pos on,     */
+/* without line terminator, truncated to size */
+/*********************************************/
+static int nextline( struct poster_job *job, char *buf, int size, size_t *pos)
+{
+	char *inbuf = job->inbuf;
+	size_t p = *pos, insize = job->insize;
+	int n = 0;
+
+	if (p >= insize) return 0;
+
+	while (p < insize && inbuf[p] != '\n' && inbuf[p] != '\r')
+	{	if (n < size-1) buf[n++] = inbuf[p];
+		p++;
+	}
+	buf[n] = '\0';
+
+	/* skip the line terminator: LF, CR or CR-LF */
+	if (p < insize && inbuf[p++] == '\r' && p < insize && inbuf[p] == '\n')
+		p++;
+	*pos = p;
+	return 1;
+}
+
+/*********************************************/
+/* scan the input once, and record the byte  */
+/* ranges that each tile copies to output    */
+/*********************************************/
+static int scanbody( struct poster_job *job)
+{
+	/* do not copy postscript comment lines: those (DSC) lines */
+	/* sometimes disturb proper previewing of the result with ghostview */
+	/* I surely dont want to print a 'cntl_D' on the last line */
+	/* Only comment lines matter, so search for '%' over large blocks */
+	/* (memchr), instead of looking at every line start. */
+	/* Binary data announced by %%BeginBinary or %%BeginData is */
+	/* copied as is, without looking into it at all. */
+
+	char *inbuf = job->inbuf;
+	size_t start, q, end, limit, last, data, cntl_D;
+	struct resscan rs;
+	char *c;
+	int level;
+
+	/* start of the last line: its cntl_D and beyond is dropped */
+	for (last = job->insize; last > 0 && inbuf[last-1] != '\n' &&
+					inbuf[last-1] != '\r'; last--);
+	if (last == job->insize && last > 0)
+	{	/* file ends with a line terminator: last line is before it */
+		for (last--; last > 0 && inbuf[last-1] != '\n' &&
+					inbuf[last-1] != '\r'; last--);
+	}
+	limit = job->insize;
+	cntl_D = 0;
+	if ((c = memchr( inbuf + last, '\04', job->insize - last)))
+	{	job->tail_cntl_D = 1;
+		limit = cntl_D = c - inbuf;
+	}
+
+	job->nspans = 0;
+	job->bodysize = 0;
+	job->npages = 0;
+	job->trailer = 0;
+	job->nresources = 0;
+	level = 0;
+	memset( &rs, 0, sizeof( rs));
+	rs.hoistable = 1;
+	for (start = q = 0; q < limit; )
+	{	if (!(c = memchr( inbuf + q, '%', limit - q)))
+			break;
+		q = c - inbuf;
+		if (q > 0 && inbuf[q-1] != '\n' && inbuf[q-1] != '\r')
+		{	q++;	/* not at a line start */
+			continue;
+		}
+
+		/* a comment line: copy up to it, skip it */
+		if (addspan( job, start, q) < 0)
+			return -1;
+		end = lineend( inbuf, q, limit);
+		if (pagecomment( job, q, end, &level) < 0 ||
+		    rescomment( job, q, end, level, &rs) < 0)
+			return -1;
+		data = datasize( inbuf, q, end, limit);
+		start = q = end;
+		if (data > 0)
+		{	/* binary data: part of the next range, unscanned */
+			q = end + data;
+			if (job->tail_cntl_D && q > cntl_D)
+			{	/* that cntl_D was data after all */
+				job->tail_cntl_D = 0;
+				limit = job->insize;
+			}
+			if (q > limit) q = limit;
+		}
+	}
+	if (addspan( job, start, limit) < 0)
+		return -1;
+	if (job->npages > 0 && job->pages[ job->npages-1].end == 0)
+		job->pages[ job->npages-1].end = limit;
+	if (job->trailer == 0)
+		job->trailer = limit;
+
+	note( job, 2, "   Input of %lu bytes copies %ld bytes in %d range%s per tile\n",
+		(unsigned long)job->insize, job->bodysize,
+		job->nspans, job->nspans==1?"":"s");
+	return 0;
+}
+
+/* position after the line that starts at p */
+static size_t lineend( char *inbuf, size_t p, size_t limit)
+{
+	char *nl, *cr;
+	size_t end;
+
+	if ((nl = memchr( inbuf + p, '\n', limit - p)))
+		end = nl - inbuf + 1;
+	else	end = limit;
+	/* old mac files end their lines with CR only */
+	if ((cr = memchr( inbuf + p, '\r', end - p)) &&
+	    cr - inbuf + 1 < end && cr[1] != '\n')
+		end = cr - inbuf + 1;
+	return end;
+}
+
+/* the number of data bytes following a %%BeginBinary or %%BeginData */
+/* comment line [p,end), 0 if it is another comment */
+static size_t datasize( char *inbuf, size_t p, size_t end, size_t limit)
+{
+	char line[BUFSIZE], type[BUFSIZE], unit[BUFSIZE];
+	size_t l = end - p, q;
+	long n;
+	int k;
+
+	if (l < 14 || inbuf[p+1] != '%' || inbuf[p+2] != 'B')
+		return 0;
+	if (l >= BUFSIZE) l = BUFSIZE-1;
+	memcpy( line, inbuf + p, l);
+	line[l] = '\0';
+
+	if (sscanf( line, "%%%%BeginBinary: %ld", &n) == 1 && n > 0)
+		return n;
+
+	/* %%BeginData: numberof [type [bytesorlines]] */
+	*unit = '\0';
+	k = sscanf( line, "%%%%BeginData: %ld %1023s %1023s", &n, type, unit);
+	if (k < 1 || n <= 0)
+		return 0;
+	if (strcmp( unit, "Lines"))
+		return n;	/* Bytes, the default */
+
+	for (q = end; n > 0 && q < limit; n--)
+		q = lineend( inbuf, q, limit);
+	return q - end;
+}
+
+/* record that [start,end) goes into each tile */
+static int addspan( struct poster_job *job, size_t start, size_t end)
+{
+	struct poster_span *sp;
+
+	if (end <= start)
+		return 0;
+	sp = job->spans + job->nspans - 1;
+	if (job->nspans > 0 && sp->off + sp->len == start)
+		sp->len += end - start;  /* extend range */
+	else
+	{	if (job->nspans == job->maxspans)
+		{	job->maxspans = job->maxspans ? 2*job->maxspans : 64;
+			sp = realloc( job->spans, job->maxspans * sizeof( *sp));
+			if (!sp)
+				return fail( job, "Out of memory!");
+			job->spans = sp;
+		}
+		sp = job->spans + job->nspans++;
+		sp->off = start;
+		sp->len = end - start;
+	}
+	job->bodysize += end - start;
+	return 0;
+}
+
+/* note the pages of the input, from its comment line [p,end) */
+static int pagecomment( struct poster_job *job, size_t p, size_t end, int *level)
+{
+	char *inbuf = job->inbuf, line[BUFSIZE];
+	struct poster_page *pg;
+	size_t l = end - p;
+
+	if (l < 7 || inbuf[p+1] != '%')
+		return 0;
+	if (l >= 15 && !strncmp( inbuf + p, "%%BeginDocument", 15))
+		(*level)++;
+	else if (l >= 13 && !strncmp( inbuf + p, "%%EndDocument", 13))
+		(*level)--;
+	if (*level > 0)
+		return 0;
+
+	if (!strncmp( inbuf + p, "%%Page:", 7))
+	{	if (job->npages == job->maxpages)
+		{	job->maxpages = job->maxpages ? 2*job->maxpages : 64;
+			pg = realloc( job->pages, job->maxpages * sizeof( *pg));
+			if (!pg)
+				return fail( job, "Out of memory!");
+			job->pages = pg;
+		}
+		if (job->npages > 0)
+			job->pages[ job->npages-1].end = p;
+		pg = job->pages + job->npages++;
+		memset( pg, 0, sizeof( *pg));
+		pg->off = p;
+	}
+	else if (l >= 18 && !strncmp( inbuf + p, "%%PageBoundingBox:", 18) &&
+		 job->npages > 0)
+	{	pg = job->pages + job->npages-1;
+		if (l >= BUFSIZE) l = BUFSIZE-1;
+		memcpy( line, inbuf + p, l);
+		line[l] = '\0';
+		pg->got_bb = sscanf( line + 18, "%lf %lf %lf %lf",
+			pg->bb, pg->bb+1, pg->bb+2, pg->bb+3) == 4;
+	}
+	else if (l >= 9 && !strncmp( inbuf + p, "%%Trailer", 9) && job->trailer == 0)
+	{	if (job->npages > 0)
+			job->pages[ job->npages-1].end = p;
+		job->trailer = p;
+	}
+	return 0;
+}
+
+/* note the resources of the prolog and document setup, from the */
+/* comment line [p,end); resources within resources go with them */
+static int rescomment( struct poster_job *job, size_t p, size_t end, int level,
+		       struct resscan *rs)
+{
+	char *inbuf = job->inbuf;
+	size_t l = end - p;
+
+	if (level > 0 || l < 7 || inbuf[p+1] != '%')
+		return 0;
+	if (l >= 16 && !strncmp( inbuf + p, "%%BeginResource:", 16))
+	{	if (rs->depth++ == 0)
+		{	rs->start = p;
+			rs->take = rs->hoistable;
+		}
+	}
+	else if (l >= 13 && !strncmp( inbuf + p, "%%EndResource", 13))
+	{	if (rs->depth > 0 && --rs->depth == 0 && rs->take)
+			return addresource( job, rs->start, end);
+	}
+	else if (rs->depth > 0)
+		return 0;
+	else if (l >= 11 && !strncmp( inbuf + p, "%%EndProlog", 11))
+		rs->hoistable = 0;
+	else if (l >= 12 && !strncmp( inbuf + p, "%%BeginSetup", 12))
+		rs->hoistable = !rs->done;
+	else if ((l >= 10 && !strncmp( inbuf + p, "%%EndSetup", 10)) ||
+		 !strncmp( inbuf + p, "%%Page:", 7) ||
+		 (l >= 9 && !strncmp( inbuf + p, "%%Trailer", 9)))
+	{	rs->hoistable = 0;
+		rs->done = 1;
+	}
+	return 0;
+}
+
+/* record the resource [start,end), with its comment lines */
+static int addresource( struct poster_job *job, size_t start, size_t end)
+{
+	struct poster_span *r;
+
+	if (job->nresources == job->maxresources)
+	{	job->maxresources = job->maxresources ? 2*job->maxresources : 16;
+		r = realloc( job->resources, job->maxresources * sizeof( *r));
+		if (!r)
+			return fail( job, "Out of memory!");
+		job->resources = r;
+	}
+	r = job->resources + job->nresources++;
+	r->off = start;
+	r->len = end - start;
+	return 0;
+}
+
+/* are the resources sent once, instead of with every tile? */
+static int hoisting( struct poster_job *job)
+{
+	return job->hoist && job->nresources > 0 && !job->pdf;
+}
+
+/* the type and name of a resource, as its %%BeginResource has them */
+static char *resname( struct poster_job *job, struct poster_span *r, int *len)
+{
+	char *c = job->inbuf + r->off + 16, *e = job->inbuf + r->off + r->len;
+
+	for (; c < e && (*c == ' ' || *c == '\t'); c++)
+		;
+	for (*len = 0; c + *len < e && c[*len] != '\n' && c[*len] != '\r'; (*len)++)
+		;
+	return c;
+}
+
+/*********************************************/
+/* output first part of DSC header           */
+/*********************************************/
+static void dsc_head1( struct poster_job *job, struct out *out)
+{
+	char *p, *e, *end = job->dsclines + job->dsclen, *name;
+	int i, skip, len;
+
+	oprintf( out, "%%!PS-Adobe-3.0\n");
+	oprintf( out, "%%%%Creator: %s\n", job->creator);
+	if (!hoisting( job))
+	{	owrite( out, job->dsclines, job->dsclen);
+		return;
+	}
+
+	/* the resources supplied are those of the setup now */
+	for (p = job->dsclines, skip = 0; p < end; p = e)
+	{	e = memchr( p, '\n', end - p) + 1;
+		if (!strncmp( p, "%%DocumentSuppliedResources", 27))
+			skip = 1;
+		else if (!skip || strncmp( p, "%%+", 3))
+		{	skip = 0;
+			owrite( out, p, e - p);
+		}
+	}
+	for (i = 0; i < job->nresources; i++)
+	{	name = resname( job, job->resources + i, &len);
+		oprintf( out, "%s %.*s\n", i ? "%%+" : "%%DocumentSuppliedResources:",
+			len, name);
+	}
+}
+
+/*********************************************/
+/* index cache: the outcome of dsc_infile()  */
+/* and scanbody() for a file, kept in a file */
+/* in indexdir, so that repeated runs on the */
+/* same input need not scan it again.        */
+/* The index file starts with text lines:    */
+/*   magic, input path, input identity, scan */
+/* results, followed by the image, spans,    */
+/* pages and resources (binary) and the      */
+/* passed DSC lines.                         */
+/*********************************************/
+#define IndexMagic "%!poster-index 5"
+#define IndexSample (64 * 1024)
+
+/* use the index for this input, when it is there and up to date */
+/* returns 0 when used, 1 when not, -1 on errors */
+static int index_load( struct poster_job *job)
+{
+	char name[PATH_MAX], path[PATH_MAX], line[PATH_MAX], *c;
+	long dev, ino, mtime, mnsec, ctime, cnsec;
+	unsigned long long size, hash;
+	int got_bb, cntl_D, nspans, npages, nresources;
+	long bodysize;
+	unsigned long dsclen, trailer;
+	double bb[4];
+	FILE *fp;
+	int ok;
+
+	if (index_name( job, path, name, sizeof( name)) < 0 ||
+	    !(fp = fopen( name, "r")))
+		return 1;
+
+	/* does it describe this very file? */
+	ok = fgets( line, PATH_MAX, fp) &&
+	     !strncmp( line, IndexMagic, strlen( IndexMagic)) &&
+	     atoi( line + strlen( IndexMagic)) == (int)sizeof( struct poster_span) &&
+	     fgets( line, PATH_MAX, fp) &&
+	     (c = strchr( line, '\n')) && (*c = '\0', !strcmp( line, path)) &&
+	     fgets( line, PATH_MAX, fp) &&
+	     sscanf( line, "%ld %ld %llu %ld.%ld %ld.%ld %llx",
+		     &dev, &ino, &size, &mtime, &mnsec, &ctime, &cnsec, &hash) == 8 &&
+	     dev == job->indev && ino == job->inino && size == job->insize &&
+	     mtime == job->inmtime && mnsec == job->inmnsec &&
+	     ctime == job->inctime && cnsec == job->incnsec &&
+	     hash == index_hash( job) &&
+	     fgets( line, PATH_MAX, fp) &&
+	     sscanf( line, "%d %lf %lf %lf %lf %d %ld %d %lu %d %lu %d",
+		     &got_bb, bb, bb+1, bb+2, bb+3, &cntl_D, &bodysize,
+		     &nspans, &dsclen, &npages, &trailer, &nresources) == 12 &&
+	     nspans >= 0 && npages >= 0 && nresources >= 0 &&
+	     /* no more than the input could give, before allocating */
+	     (size_t)nspans <= job->insize && (size_t)npages <= job->insize &&
+	     (size_t)nresources <= job->insize && dsclen <= job->insize + BUFSIZE;
+	if (!ok)
+	{	fclose( fp);
+		note( job, 1, "Index '%s' is out of date, scanning again\n", name);
+		return 1;
+	}
+
+	if (nspans > job->maxspans)
+	{	struct poster_span *sp = realloc( job->spans, nspans * sizeof( *sp));
+		if (!sp)
+		{	fclose( fp);
+			return fail( job, "Out of memory!");
+		}
+		job->spans = sp;
+		job->maxspans = nspans;
+	}
+	if (npages > job->maxpages)
+	{	struct poster_page *pg = realloc( job->pages, npages * sizeof( *pg));
+		if (!pg)
+		{	fclose( fp);
+			return fail( job, "Out of memory!");
+		}
+		job->pages = pg;
+		job->maxpages = npages;
+	}
+	if (nresources > job->maxresources)
+	{	struct poster_span *r = realloc( job->resources, nresources * sizeof( *r));
+		if (!r)
+		{	fclose( fp);
+			return fail( job, "Out of memory!");
+		}
+		job->resources = r;
+		job->maxresources = nresources;
+	}
+	if (dsclen > job->dscalloc)
+	{	char *p = realloc( job->dsclines, dsclen);
+		if (!p)
+		{	fclose( fp);
+			return fail( job, "Out of memory!");
+		}
+		job->dsclines = p;
+		job->dscalloc = dsclen;
+	}
+	if (fread( &job->image, sizeof( job->image), 1, fp) != 1 ||
+	    fread( job->spans, sizeof( struct poster_span), nspans, fp) != (size_t)nspans ||
+	    fread( job->pages, sizeof( struct poster_page), npages, fp) != (size_t)npages ||
+	    fread( job->resources, sizeof( struct poster_span), nresources, fp) != (size_t)nresources ||
+	    fread( job->dsclines, 1, dsclen, fp) != dsclen ||
+	    fgetc( fp) != EOF ||
+	    index_check( job, nspans, npages, nresources, dsclen, trailer, bodysize) < 0)
+	{	fclose( fp);
+		memset( &job->image, 0, sizeof( job->image));
+		note( job, 1, "Index '%s' is damaged, scanning again\n", name);
+		return 1;
+	}
+	fclose( fp);
+
+	job->got_bb = got_bb;
+	memcpy( job->ps_bb, bb, sizeof( bb));
+	job->tail_cntl_D = cntl_D;
+	job->bodysize = bodysize;
+	job->nspans = nspans;
+	job->npages = npages;
+	job->nresources = nresources;
+	job->trailer = trailer;
+	job->dsclen = dsclen;
+	note( job, 1, "Using scan results of '%s' from index '%s'\n",
+		job->inname, name);
+	return 0;
+}
+
+/* do the ranges read from an index fit the input, in the order */
+/* the scan gives them?  An index cut short or damaged otherwise */
+/* would send the output reading beyond inbuf */
+static int index_check( struct poster_job *job, int nspans, int npages,
+			int nresources, size_t dsclen, size_t trailer, long bodysize)
+{
+	struct poster_span *sp;
+	struct poster_page *pg;
+	struct poster_image *im = &job->image;
+	size_t insize = job->insize, at;
+	long sum = 0;
+	int i;
+
+	for (i = 0, at = 0; i < nspans; i++)
+	{	sp = job->spans + i;
+		if (sp->off < at || sp->off > insize || sp->len > insize - sp->off)
+			return -1;
+		at = sp->off + sp->len;
+		sum += sp->len;
+	}
+	if (sum != bodysize)
+		return -1;
+	for (i = 0, at = 0; i < npages; i++)
+	{	pg = job->pages + i;
+		if (pg->off < at || pg->end < pg->off || pg->end > insize)
+			return -1;
+		at = pg->off;
+	}
+	for (i = 0, at = 0; i < nresources; i++)
+	{	sp = job->resources + i;
+		if (sp->off < at || sp->off > insize || sp->len > insize - sp->off ||
+		    sp->len < 16 || strncmp( job->inbuf + sp->off, "%%BeginResource:", 16))
+			return -1;
+		at = sp->off + sp->len;
+	}
+	if (trailer > insize)
+		return -1;
+	if (im->found && (im->start > im->dataoff || im->dataoff > im->dataend ||
+			  im->dataend > insize))
+		return -1;
+	/* every DSC line kept ends in a newline */
+	if (dsclen > 0 && job->dsclines[dsclen - 1] != '\n')
+		return -1;
+	return 0;
+}
+
+/* keep the scan results in the index; */
+/* failures only cost a scan next time, so are not errors */
+static void index_save( struct poster_job *job)
+{
+	char name[PATH_MAX], tmp[PATH_MAX+8], path[PATH_MAX];
+	FILE *fp;
+	int fd;
+
+	if (index_name( job, path, name, sizeof( name)) < 0)
+		return;
+	/* write aside and rename, so that readers never see half an index */
+	snprintf( tmp, sizeof( tmp), "%s.XXXXXX", name);
+	if ((fd = mkstemp( tmp)) < 0)
+	{	note( job, 1, "Cannot create index '%s'\n", name);
+		return;
+	}
+	if (!(fp = fdopen( fd, "w")))
+	{	close( fd);
+		unlink( tmp);
+		return;
+	}
+	fprintf( fp, "%s %d\n%s\n", IndexMagic, (int)sizeof( struct poster_span), path);
+	fprintf( fp, "%ld %ld %llu %ld.%09ld %ld.%09ld %llx\n",
+		job->indev, job->inino, (unsigned long long)job->insize,
+		job->inmtime, job->inmnsec, job->inctime, job->incnsec,
+		index_hash( job));
+	fprintf( fp, "%d %.17g %.17g %.17g %.17g %d %ld %d %lu %d %lu %d\n",
+		job->got_bb, job->ps_bb[0], job->ps_bb[1], job->ps_bb[2],
+		job->ps_bb[3], job->tail_cntl_D, job->bodysize, job->nspans,
+		(unsigned long)job->dsclen, job->npages,
+		(unsigned long)job->trailer, job->nresources);
+	fwrite( &job->image, sizeof( job->image), 1, fp);
+	fwrite( job->spans, sizeof( struct poster_span), job->nspans, fp);
+	fwrite( job->pages, sizeof( struct poster_page), job->npages, fp);
+	fwrite( job->resources, sizeof( struct poster_span), job->nresources, fp);
+	fwrite( job->dsclines, 1, job->dsclen, fp);
+	if (fclose( fp) || rename( tmp, name) < 0)
+	{	note( job, 1, "Cannot write index '%s'\n", name);
+		unlink( tmp);
+		return;
+	}
+	note( job, 2, "   Scan results kept in index '%s'\n", name);
+}
+
+/* the full path of the input (PATH_MAX), and its index file */
+/* name, made from the hash of that path */
+static int index_name( struct poster_job *job, char *path, char *name, size_t size)
+{
+	int n;
+
+	if (!realpath( job->infile, path))
+		return -1;
+	n = snprintf( name, size, "%s/%016llx.pidx", job->indexdir,
+		fnv( 14695981039346656037ULL, path, strlen( path)));
+	return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+/* hash of the input contents: its head, its tail and samples */
+/* in between, to catch changes that keep size and time stamp, */
+/* while not costing a full pass over the input */
+static unsigned long long index_hash( struct poster_job *job)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	size_t n = job->insize, step, p;
+
+	if (n <= 2 * IndexSample)
+		return fnv( h, job->inbuf, n);
+	h = fnv( h, job->inbuf, IndexSample);
+	step = (n - 2 * IndexSample) / 16;
+	for (p = IndexSample; step >= 4096 && p + 4096 <= n - IndexSample; p += step)
+		h = fnv( h, job->inbuf + p, 4096);
+	return fnv( h, job->inbuf + n - IndexSample, IndexSample);
+}
+
+/* 64 bit FNV-1a */
+static unsigned long long fnv( unsigned long long h, const char *p, size_t n)
+{
+	while (n-- > 0)
+	{	h ^= (unsigned char)*p++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*********************************************/
+/* output cache: whole outputs kept in       */
+/* cachedir, named by the hash of the input  */
+/* contents and of all else that shows in    */
+/* the output, to be copied instead of made  */
+/* again.  Entries are written aside and     */
+/* renamed, so that jobs sharing the cache   */
+/* never see half an output; the least       */
+/* recently used go when the cache grows     */
+/* beyond cachesize.                         */
+/*********************************************/
+#define CacheVersion "poster-cache 2"	/* a new one for changed output */
+#define CacheStale 3600		/* seconds: an entry being filled was left */
+
+struct cacheentry {
+	char name[64];
+	off_t size;
+	double used;		/* time of last use */
+};
+
+/* the cache file of the output of tiles first..first+npages-1 */
+static int cache_name( struct poster_job *job, int first, int npages,
+		       char *name, size_t size)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	struct poster_page *pg;
+	char buf[BUFSIZE];
+	int i, n, t;
+
+	h = fnv( h, CacheVersion, sizeof( CacheVersion));
+	/* the strings of the job the output shows; those of the */
+	/* input (DSC lines, resource names) are in inhash */
+	h = fnv( h, job->creator, strlen( job->creator) + 1);
+	h = fnv( h, job->inname, strlen( job->inname) + 1);
+	h = fnv( h, job->mediaspec, strlen( job->mediaspec) + 1);
+	n = snprintf( buf, sizeof( buf), "%d %d %d %d %d %d %d %d %d %d %d %d %d %d",
+		job->pdf != NULL, job->manualfeed, job->formmode,
+		job->wholeimage, job->pagemode, job->hoist, job->rollspec != NULL,
+		job->strict, job->gzlevel,
+		first, npages, job->rotate, job->nrows, job->ncols);
+	h = fnv( h, buf, n);
+	h = fnv( h, (char *)job->sheetsize, sizeof( job->sheetsize));
+	h = fnv( h, (char *)job->sheetmargin, sizeof( job->sheetmargin));
+	h = fnv( h, (char *)job->whitemargin, sizeof( job->whitemargin));
+	h = fnv( h, (char *)job->imagebb, sizeof( job->imagebb));
+	h = fnv( h, (char *)job->posterbb, sizeof( job->posterbb));
+	h = fnv( h, (char *)&job->scale, sizeof( job->scale));
+	for (i = first; i < first + npages; i++)
+	{	t = tilenumber( job, i);
+		h = fnv( h, (char *)&t, sizeof( t));
+	}
+	for (i = 0; paging( job) && i < job->npages; i++)
+	{	pg = job->pages + i;
+		h = fnv( h, (char *)pg->imagebb, sizeof( pg->imagebb));
+		h = fnv( h, (char *)pg->posterbb, sizeof( pg->posterbb));
+		n = snprintf( buf, sizeof( buf), "%.17g %d %d %d",
+			pg->scale, pg->rotate, pg->nrows, pg->ncols);
+		h = fnv( h, buf, n);
+	}
+
+	n = snprintf( name, size, "%s/%016llx-%016llx.pout", job->cachedir,
+		job->inhash, h);
+	return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+/* copy the output kept in the cache to sink; */
+/* returns 0 when done, 1 when it is not there, -1 on errors */
+static int cache_copy( struct poster_job *job, char *name,
+		       struct poster_sink *sink, struct poster_stats *stats)
+{
+	double t0 = now();
+	struct stat st;
+	size_t done = 0;
+	char *p;
+	int fd, r = 0;
+
+	if ((fd = open( name, O_RDONLY)) < 0)
+		return 1;
+	if (fstat( fd, &st) < 0 || st.st_size == 0)
+	{	close( fd);
+		return 1;
+	}
+	futimens( fd, NULL);	/* used now, for the eviction */
+	note( job, 1, "Output of '%s' from cache '%s'\n", job->inname, name);
+#ifdef __linux__
+	/* into a file: its file system may share the blocks, or copy */
+	/* them without passing through here */
+	if (sink->write == sink_fd)
+	{	ssize_t n;
+
+		while (done < (size_t)st.st_size &&
+		       (n = copy_file_range( fd, NULL, (int)(long)sink->handle,
+					     NULL, st.st_size - done, 0)) > 0)
+			done += n;
+	}
+#endif
+	if (done < (size_t)st.st_size)
+	{	if ((p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+		    == MAP_FAILED)
+			r = -1;
+		else
+		{	r = sink->write( sink->handle, p + done, st.st_size - done);
+			munmap( p, st.st_size);
+		}
+	}
+	close( fd);
+
+	stats->cached = 1;
+	stats->sinkbytes += st.st_size;
+	if (!job->gzlevel)
+		stats->outbytes += st.st_size;
+	stats->tiletime += now() - t0;
+	if (r < 0)
+		return fail( job, "Write error on output!");
+	return 0;
+}
+
+/* a new file aside of the cache entry name, to fill */
+static int cache_create( struct poster_job *job, char *name, char *tmp, size_t size)
+{
+	int fd;
+
+	snprintf( tmp, size, "%s.XXXXXX", name);
+	if ((fd = mkstemp( tmp)) < 0)
+		note( job, 1, "Cannot create cache entry '%s'\n", name);
+	return fd;
+}
+
+/* a sink that passes everything on, and keeps a copy */
+static int sink_cachefill( void *handle, const char *buf, size_t n)
+{
+	struct cachefill *fill = handle;
+
+	if (!fill->err && sink_fd( (void *)(long)fill->fd, buf, n) < 0)
+		fill->err = 1;
+	return fill->sink->write( fill->sink->handle, buf, n);
+}
+
+/* the copy of a good output becomes the cache entry; */
+/* failures only cost making it again, so are not errors */
+static void cache_insert( struct poster_job *job, struct cachefill *fill,
+			  int r, char *tmp, char *name)
+{
+	if (close( fill->fd) < 0)
+		fill->err = 1;
+	if (r < 0 || fill->err || rename( tmp, name) < 0)
+	{	if (r == 0)
+			note( job, 1, "Cannot write cache entry '%s'\n", name);
+		unlink( tmp);
+		return;
+	}
+	note( job, 2, "   Output kept in cache '%s'\n", name);
+	cache_evict( job);
+}
+
+/* drop the least recently used entries, until the cache fits */
+/* cachesize; another job may be doing the same */
+static void cache_evict( struct poster_job *job)
+{
+	struct cacheentry *e = NULL;
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+	double total = 0;
+	time_t t = time( NULL);
+	int n = 0, max = 0, i;
+	size_t l;
+	DIR *dir;
+
+	if (!(dir = opendir( job->cachedir)))
+		return;
+	while ((de = readdir( dir)))
+	{	l = strlen( de->d_name);
+		if (!strstr( de->d_name, ".pout") || l >= sizeof( e->name))
+			continue;
+		snprintf( path, sizeof( path), "%s/%s", job->cachedir, de->d_name);
+		if (stat( path, &st) < 0 || !S_ISREG( st.st_mode))
+			continue;
+		if (strcmp( de->d_name + l - 5, ".pout"))
+		{	/* being filled, or left by a job that died */
+			if (st.st_mtime < t - CacheStale)
+				unlink( path);
+			continue;
+		}
+		if (dbgrow( &e, &max, n + 1, sizeof( *e)) < 0)
+			break;
+		strcpy( e[n].name, de->d_name);
+		e[n].size = st.st_size;
+		e[n].used = st.st_mtim.tv_sec + 1e-9 * st.st_mtim.tv_nsec;
+		total += st.st_size;
+		n++;
+	}
+	closedir( dir);
+
+	if (total > job->cachesize)
+	{	qsort( e, n, sizeof( *e), cmpused);
+		for (i = 0; i < n && total > job->cachesize; i++)
+		{	snprintf( path, sizeof( path), "%s/%s", job->cachedir, e[i].name);
+			unlink( path);
+			total -= e[i].size;
+			note( job, 2, "   Dropped '%s' from the cache\n", e[i].name);
+		}
+	}
+	free( e);
+}
+
+/* least recently used first */
+static int cmpused( const void *a, const void *b)
+{
+	const struct cacheentry *p = a, *q = b;
+
+	if (p->used != q->used)
+		return p->used < q->used ? -1 : 1;
+	return strcmp( p->name, q->name);
+}
+
+/*********************************************/
+/* pass some DSC info from the infile in the new DSC header */
+/* such as document fonts and */
+/* extract BoundingBox info from the PS file */
+/*********************************************/
+static int dsc_infile( struct poster_job *job)
+{
+	char buf[BUFSIZE];
+	int atend, level, dsc_cont;
+	size_t pos;
+
+	job->got_bb = 0;
+	job->dsclen = 0;
+	pos = 0;
+	dsc_cont = level = atend = 0;
+	/* the header: up to %%EndComments or the first non-comment line */
+	while (nextline( job, buf, BUFSIZE, &pos))
+	{	if (buf[0] != '%' || !strncmp( buf, "%%EndComments", 13))
+			break;
+		if (dsc_comment( job, buf, &level, &dsc_cont, &atend) < 0)
+			return -1;
+	}
+	if (!atend)
+		return 0;
+
+	/* (atend): find the trailer from the end of the file, */
+	/* instead of reading through the whole document */
+	if (!(pos = dsc_trailer( job, pos)))
+	{	note( job, 1, "No %%%%Trailer found for the (atend) comments\n");
+		return 0;
+	}
+	note( job, 2, "   Trailer found %lu bytes before the end of the input\n",
+		(unsigned long)(job->insize - pos));
+	dsc_cont = level = 0;
+	while (nextline( job, buf, BUFSIZE, &pos))
+	{	if (buf[0] != '%')
+		{	dsc_cont = 0;
+			continue;
+		}
+		if (dsc_comment( job, buf, &level, &dsc_cont, &atend) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* handle one DSC line of the header or trailer */
+static int dsc_comment( struct poster_job *job, char *buf,
+			int *level, int *dsc_cont, int *atend)
+{
+	double *ps_bb = job->ps_bb;
+	char *c;
+
+	if (!strncmp( buf, "%%+",3) && *dsc_cont)
+		return dsc_pass( job, buf);
+
+	*dsc_cont = 0;
+	if      (!strncmp( buf, "%%BeginDocument", 15) ||
+	         !strncmp( buf, "%%BeginData", 11)) (*level)++;
+	else if (!strncmp( buf, "%%EndDocument", 13) ||
+	         !strncmp( buf, "%%EndData", 9)) (*level)--;
+	else if (!strncmp( buf, "%%BoundingBox:", 14) && !*level)
+	{	for (c=buf+14; *c==' ' || *c=='\t'; c++);
+		if (!strncmp( c, "(atend)", 7)) *atend = 1;
+		else
+		{	sscanf( c, "%lf %lf %lf %lf",
+			       ps_bb, ps_bb+1, ps_bb+2, ps_bb+3);
+			job->got_bb = 1;
+		}
+	}
+	else if (!strncmp( buf, "%%Document", 10) && !*level)
+	{	/* several kinds of doc props */
+		for (c=buf+10; *c && *c!=' ' && *c!='\t'; c++);
+		for (; *c==' ' || *c=='\t'; c++);
+		if (!strncmp( c, "(atend)", 7)) *atend = 1;
+		else
+		{	/* pass this DSC to output */
+			/* if it is not another DocumentMedia comment */
+			if (strncmp( buf, "%%DocumentMedia", 15))
+			{
+				if (dsc_pass( job, buf) < 0) return -1;
+				*dsc_cont = 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* search the input backwards, down to position from, for the */
+/* %%Trailer line of the document itself, not that of a document */
+/* embedded between %%BeginDocument and %%EndDocument. */
+/* Returns the position after that line, or 0 when there is none. */
+static size_t dsc_trailer( struct poster_job *job, size_t from)
+{
+	char *inbuf = job->inbuf;
+	size_t s, e, l;
+	int level = 0;
+
+	for (e = job->insize; e > from; e = s)
+	{	/* the line [s,e) */
+		while (e > from && (inbuf[e-1] == '\n' || inbuf[e-1] == '\r'))
+			e--;
+		for (s = e; s > from && inbuf[s-1] != '\n' && inbuf[s-1] != '\r'; s--);
+		l = e - s;
+		if (l < 9 || inbuf[s] != '%' || inbuf[s+1] != '%')
+			continue;
+
+		/* going backwards, an End opens a nested part */
+		if ((l >= 13 && !strncmp( inbuf + s, "%%EndDocument", 13)) ||
+		    !strncmp( inbuf + s, "%%EndData", 9))
+			level++;
+		else if ((l >= 15 && !strncmp( inbuf + s, "%%BeginDocument", 15)) ||
+			 (l >= 11 && !strncmp( inbuf + s, "%%BeginData", 11)))
+		{	if (level > 0) level--;
+		}
+		else if (!strncmp( inbuf + s, "%%Trailer", 9) && level == 0)
+			return lineend( inbuf, s, job->insize);
+	}
+	return 0;
+}
+
+/* keep an input DSC line for the output header(s) */
+static int dsc_pass( struct poster_job *job, char *line)
+{
+	size_t l = strlen( line);
+	char *p;
+
+	if (job->dsclen + l + 1 > job->dscalloc)
+	{	job->dscalloc = 2*job->dscalloc + l + BUFSIZE;
+		if (!(p = realloc( job->dsclines, job->dscalloc)))
+			return fail( job, "Out of memory!");
+		job->dsclines = p;
+	}
+	memcpy( job->dsclines + job->dsclen, line, l);
+	job->dsclines[ job->dsclen + l] = '\n';
+	job->dsclen += l + 1;
+	return 0;
+}
+
+/*********************************************/
+/* output last part of DSC header            */
+/*********************************************/
+static void dsc_head2( struct poster_job *job, struct out *out, int npages)
+{
+	oprintf( out, "%%%%Pages: %d\n", npages);
+
+#ifndef Gv_gs_orientbug
+	oprintf( out, "%%%%Orientation: %s\n", job->rotate?"Landscape":"Portrait");
+#endif
+	oprintf( out, "%%%%DocumentMedia: %s %d %d 0 white ()\n",
+		job->mediaspec, (int)(job->sheetsize[2]), (int)(job->sheetsize[3]));
+	oprintf( out, "%%%%BoundingBox: 0 0 %d %d\n",
+		(int)(job->sheetsize[2]), (int)(job->sheetsize[3]));
+	if (job->strict)
+		oprintf( out, "%%%%PageOrder: Ascend\n");
+	oprintf( out, "%%%%EndComments\n\n");
+
+	if (paging( job))
+		oprintf( out, "%% Print poster %s page by page, %d pages in %d tiles\n",
+			job->inname, job->npages, job->ntiles);
+	else
+		oprintf( out, "%% Print poster %s in %dx%d tiles with %.3g magnification\n",
+			job->inname, job->nrows, job->ncols, job->scale);
+}
+
+/*********************************************/
+/* output the poster, create tiles if needed */
+/* only npages of the selected tiles, from   */
+/* first on; pages keep their grid numbers   */
+/*********************************************/
+static void printposter( struct poster_job *job, struct out *out, int first, int npages)
+{
+	struct poster_page *pg, *lastpg = NULL;
+	size_t at;
+	int i, t;
+
+	printprolog( job, out);
+	out->tilestart = now();
+	for (i = first; i < first + npages; i++)
+	{	t = tilenumber( job, i);
+		at = out->done + out->len;
+		if (!paging( job))
+		{	tile( job, out, NULL, t/job->ncols + 1, t%job->ncols + 1,
+				t+1, i-first+1);
+			tiledone( out, i, at);
+			continue;
+		}
+		pg = tilepage( job, i);
+		if (pg != lastpg && !job->strict)
+		{	/* the layout of the next page */
+			oprintf( out, "\n");
+			pagedefs( out, pg);
+			lastpg = pg;
+		}
+		tile( job, out, pg, t/pg->ncols + 1, t%pg->ncols + 1,
+			t+1, i-first+1);
+		tiledone( out, i, at);
+	}
+	if (job->strict)
+		oprintf( out, "\n%%%%Trailer\n");
+	if (paging( job))
+	{	/* the trailer of the input, in the dictionaries of its setup */
+		oprintf( out, "\ntiledict begin posterpagedicts {begin} forall\n");
+		copyrange( job, out, job->trailer, job->insize);
+		oprintf( out, "\ncountdictstack posterdictcount sub 1 add {end} repeat\n");
+	}
+	oprintf( out, "%%%%EOF\n");
+
+	if (job->tail_cntl_D)
+	{	oprintf( out, "%c", 0x4);
+	}
+}
+
+/* the tiling routines: the same for every job, so plain text */
+static char prologtext[] =
+	"%%BeginProlog\n"
+	"/cutmark	% - cutmark -\n"
+	"{		% draw cutline\n"
+	"	0.23 setlinewidth 0 setgray\n"
+	"	clipmargin\n"
+	"	dup 0 moveto\n"
+	"	dup neg leftmargin add 0 rlineto stroke\n"
+	"	% draw sheet alignment mark\n"
+	"	dup dup neg moveto\n"
+	"	dup 0 rlineto\n"
+	"	dup dup lineto\n"
+	"	0 rlineto\n"
+	"	closepath fill\n"
+	"} bind def\n\n"
+	"% usage: 	row col tileprolog ps-code tilepilog\n"
+	"% these procedures output the tile specified by row & col\n"
+	"/tileprolog\n"
+	"{ 	%def\n"
+	"	gsave\n"
+	"       leftmargin botmargin translate\n"
+	"	do_turn {exch} if\n"
+	"	/colcount exch def\n"
+	"	/rowcount exch def\n"
+	"	% clip page contents\n"
+	"	clipmargin neg dup moveto\n"
+	"	pagewidth clipmargin 2 mul add 0 rlineto\n"
+	"	0 pageheight clipmargin 2 mul add rlineto\n"
+	"	pagewidth clipmargin 2 mul add neg 0 rlineto\n"
+	"	closepath clip\n"
+	"	% set page contents transformation\n"
+	"	do_turn\n"
+	"	{	pagewidth 0 translate\n"
+	"		90 rotate\n"
+	"	} if\n"
+	"	pagewidth colcount 1 sub mul neg\n"
+	"	pageheight rowcount 1 sub mul neg\n"
+	"	do_turn {exch} if\n"
+	"	translate\n"
+	"	posterxl posteryb translate\n"
+	"	sfactor dup scale\n"
+	"	imagexl neg imageyb neg translate\n"
+	"	tiledict begin\n"
+	"	0 setgray 0 setlinecap 1 setlinewidth\n"
+	"	0 setlinejoin 10 setmiterlimit [] 0 setdash newpath\n"
+	"} bind def\n\n"
+	"/tileepilog\n"
+	"{	end % of tiledict\n"
+	"	grestore\n"
+	"	% print the cutmarks\n"
+	"	gsave\n"
+	"       leftmargin botmargin translate\n"
+	"	pagewidth pageheight translate cutmark 90 rotate cutmark\n"
+	"	0 pagewidth translate cutmark 90 rotate cutmark\n"
+	"	0 pageheight translate cutmark 90 rotate cutmark\n"
+	"	0 pagewidth translate cutmark 90 rotate cutmark\n"
+	"	grestore\n"
+	"	% print the page label\n"
+	"	0 setgray\n"
+	"	leftmargin clipmargin 3 mul add clipmargin labelsize add neg botmargin add moveto\n"
+	"	(Grid \\( ) show\n"
+	"	rowcount strg cvs show\n"
+	"	( , ) show\n"
+	"	colcount strg cvs show\n"
+	"	( \\)) show\n"
+	"	showpage\n"
+	"} bind def\n\n"
+	"%%EndProlog\n\n";
+
+/*******************************************************/
+/* output PS prolog of the scaling and tiling routines */
+/*******************************************************/
+static void printprolog( struct poster_job *job, struct out *out)
+{
+	double *sheetsize = job->sheetsize;
+	double *sheetmargin = job->sheetmargin;
+	struct poster_span *r;
+	int i, seams[2];
+
+	owrite( out, prologtext, sizeof( prologtext) - 1);
+	oprintf( out, "%%%%BeginSetup\n");
+	oprintf( out, "%% Try to inform the printer about the desired media size:\n"
+	        "/setpagedevice where 	%% level-2 page commands available...\n"
+	        "{	pop		%% ignore where found\n"
+	        "	3 dict dup /PageSize [ %d %d ] put\n"
+	        "	dup /Duplex false put\n%s"
+	        "	setpagedevice\n"
+                "} if\n",
+	       (int)(sheetsize[2]), (int)(sheetsize[3]),
+	       job->manualfeed?"       dup /ManualFeed true put\n":"");
+
+	oprintf( out, "/sfactor %.10f def\n"
+	        "/leftmargin %d def\n"
+	        "/botmargin %d def\n"
+	        "/pagewidth %d def\n"
+	        "/pageheight %d def\n"
+	        "/imagexl %d def\n"
+	        "/imageyb %d def\n"
+	        "/posterxl %d def\n"
+	        "/posteryb %d def\n"
+	        "/do_turn %s def\n"
+	        "/strg 10 string def\n"
+	        "/clipmargin 6 def\n"
+	        "/labelsize 9 def\n"
+	        "/tiledict 250 dict def\n"
+	        "tiledict begin\n"
+	        "%% delay users showpage until cropmark is printed.\n"
+	        "/showpage {} def\n"
+		"/setpagedevice { pop } def\n"
+	        "end\n",
+	        job->scale, (int)(sheetmargin[0]), (int)(sheetmargin[1]),
+	        (int)(sheetsize[2]-2.0*sheetmargin[0]), (int)(sheetsize[3]-2.0*sheetmargin[1]),
+	        (int)job->imagebb[0], (int)job->imagebb[1],
+	        (int)job->posterbb[0], (int)job->posterbb[1],
+	        job->rotate?"true":"false");
+
+	oprintf( out, "/Helvetica findfont labelsize scalefont setfont\n");
+
+	if (job->rollspec)
+	{	/* tileepilog draws the horizontal and the vertical edges */
+		/* in turn: on a roll, a line along each edge that is a seam */
+		rollseams( job, seams);
+		oprintf( out, "%% On a roll: cut lines along the seams only\n"
+			"/posteredge 0 def\n"
+			"/cutmark\n"
+			"{	/posteredge posteredge 1 add def\n"
+			"	posteredge 2 mod 1 eq {%s pagewidth} {%s pageheight} ifelse\n"
+			"	exch\n"
+			"	{	0.23 setlinewidth 0 setgray\n"
+			"		0 0 moveto neg 0 rlineto stroke\n"
+			"	} { pop } ifelse\n"
+			"} bind def\n",
+			seams[1] ? "true" : "false", seams[0] ? "true" : "false");
+	}
+
+	if (hoisting( job))
+	{	/* the resources of the input, once for all tiles, */
+		/* in the dictionary the tiles run in */
+		note( job, 1, "Sending %d resource%s of %ld bytes once\n",
+			job->nresources, job->nresources==1?"":"s", job->resbytes);
+		oprintf( out, "%% Resources of %s, for all tiles\ntiledict begin\n",
+			job->inname);
+		for (i = 0; i < job->nresources; i++)
+		{	r = job->resources + i;
+			owrite( out, job->inbuf + r->off, r->len);
+			if (job->inbuf[r->off + r->len - 1] != '\n')
+				oprintf( out, "\n");
+		}
+		oprintf( out, "end\n");
+	}
+
+	if (job->formmode)
+	{	/* store the input once in VM, each tile re-executes it */
+		long size = printfile( job, NULL);
+
+		note( job, 1, "Storing %ld bytes of input as form\n", size);
+		oprintf( out, "%% Input document %s, read once for all tiles\n"
+			"/posterdoc currentfile %ld () /SubFileDecode filter\n"
+			"/ReusableStreamDecode filter\n", job->inname, size);
+		printfile( job, out);
+		oprintf( out, "\ndef\n");
+	}
+	if (paging( job))
+	{	/* the prolog and setup of the input, once for all pages; */
+		/* the dictionaries it leaves open are opened again per tile */
+		oprintf( out, "%% Prolog and setup of %s, for all pages\n"
+			"tiledict begin /posterdictcount countdictstack def\n",
+			job->inname);
+		copyrange( job, out, 0, job->pages[0].off);
+		oprintf( out, "\ncountdictstack posterdictcount sub dup array exch\n"
+			"1 sub -1 0 { 1 index exch currentdict put end } for\n"
+			"/posterpagedicts exch def end\n");
+	}
+
+	oprintf( out, "%%%%EndSetup\n");
+}
+
+/*****************************/
+/* output one tile at a time */
+/*****************************/
+static void tile ( struct poster_job *job, struct out *out, struct poster_page *pg,
+		   int row, int col, int page, int ordinal)
+{
+	if (pg)
+	{	/* a tile of page pg of the input */
+		note( job, 1, "print page %d of input page %d\n",
+			page, (int)(pg - job->pages) + 1);
+		oprintf( out, "\n%%%%Page: %d.%d %d\n",
+			(int)(pg - job->pages) + 1, page, ordinal);
+		pagebegin( job, out, pg);
+		oprintf( out, "%d %d tileprolog posterpagedicts {begin} forall\n",
+			row, col);
+		copyrange( job, out, pg->off, pg->end);
+		oprintf( out, "\nposterpagedicts length {end} repeat tileepilog\n");
+		pageend( job, out);
+		return;
+	}
+
+	note( job, 1, "print page %d\n", page);
+
+	oprintf( out, "\n%%%%Page: %d %d\n", page, ordinal);
+	pagebegin( job, out, NULL);
+	oprintf( out, "%d %d tileprolog\n", row, col);
+	if (job->formmode)
+		oprintf( out, "posterdoc dup 0 setfileposition cvx exec\n");
+	else
+	{	oprintf( out, "%%%%BeginDocument: %s\n", job->inname);
+		if (cropping( job))
+			printimage( job, out, row, col);
+		else	printfile( job, out);
+		oprintf( out, "\n%%%%EndDocument\n");
+	}
+	oprintf( out, "tileepilog\n");
+	pageend( job, out);
+}
+
+/* the layout of page pg of the input, for its tiles */
+static void pagedefs( struct out *out, struct poster_page *pg)
+{
+	oprintf( out, "/sfactor %.10f def\n"
+		"/imagexl %d def /imageyb %d def\n"
+		"/posterxl %d def /posteryb %d def\n"
+		"/do_turn %s def\n",
+		pg->scale, (int)pg->imagebb[0], (int)pg->imagebb[1],
+		(int)pg->posterbb[0], (int)pg->posterbb[1],
+		pg->rotate?"true":"false");
+}
+
+/* with -S, every page carries its own DSC and state, and */
+/* restores what it changed: spoolers may take out, reorder */
+/* or spread the pages without running the ones before */
+static void pagebegin( struct poster_job *job, struct out *out, struct poster_page *pg)
+{
+	if (!job->strict)
+		return;
+	oprintf( out, "%%%%PageBoundingBox: 0 0 %d %d\n",
+		(int)(job->sheetsize[2]), (int)(job->sheetsize[3]));
+	oprintf( out, "%%%%PageOrientation: %s\n",
+		(pg ? pg->rotate : job->rotate) ? "Landscape" : "Portrait");
+	oprintf( out, "%%%%BeginPageSetup\n/posterpagesave save def\n");
+	if (pg)
+		pagedefs( out, pg);
+	oprintf( out, "/Helvetica findfont labelsize scalefont setfont\n"
+		"%%%%EndPageSetup\n");
+}
+
+static void pageend( struct poster_job *job, struct out *out)
+{
+	if (job->strict)
+		oprintf( out, "posterpagesave restore\n%%%%PageTrailer\n");
+}
+
+/* account the output from at on to tile i of tiles[] */
+static void tiledone( struct out *out, int i, size_t at)
+{
+	if (out->job->stats.tilebytes)
+		out->job->stats.tilebytes[i] = out->done + out->len - at;
+}
+
+/******************************/
+/* copy the PS file to output */
+/******************************/
+static long printfile ( struct poster_job *job, struct out *out)
+{
+	/* Without out only return the bytes that would be printed */
+	int i;
+
+	if (!out)
+		return job->bodysize - job->resbytes;
+	if (hoisting( job))
+		return copyrange( job, out, 0, job->insize);
+	for (i = 0; i < job->nspans; i++)
+		owrite( out, job->inbuf + job->spans[i].off,
+			job->spans[i].len);
+	return job->bodysize;
+}
+
+/* estimate of the output of ntiles tiles, from the header only */
+static long planbytes( struct poster_job *job, int ntiles)
+{
+	long size = sizeof( prologtext) + 1500 + job->dsclen;
+	long tile = 64 + 2*strlen( job->inname ? job->inname : "");
+
+	if (job->pdf)
+		return size + job->insize + 600L*ntiles;
+	if (job->formmode)
+		return size + job->insize + tile*ntiles;
+	return size + (tile + (long)job->insize) * ntiles;
+}
+
+/* estimate of the output bytes of tile i of tiles[] */
+static long tilebytes( struct poster_job *job, int i)
+{
+	long size = 64 + 2*strlen( job->inname);	/* tileprolog etc. */
+	struct poster_page *pg;
+	int t;
+
+	if (job->pdf)
+		return size + 600;	/* the forms are not counted */
+	if (job->strict)
+		size += 300;		/* the page setup and trailer */
+	if (paging( job))
+	{	pg = tilepage( job, i);
+		size += copyrange( job, NULL, pg->off, pg->end);
+	}
+	else if (cropping( job))
+	{	t = tilenumber( job, i);
+		size += printimage( job, NULL, t/job->ncols + 1, t%job->ncols + 1);
+	}
+	else if (!job->formmode)
+		size += printfile( job, NULL);
+	return size;
+}
+
+/* does each tile get only its own part of the image? */
+static int cropping( struct poster_job *job)
+{
+	return job->image.found && !job->formmode && !job->wholeimage &&
+		!paging( job);
+}
+
+/*********************************************/
+/* image cropping: when the input is one big */
+/* sampled image in a thin EPS wrapper, each */
+/* tile gets only the samples that show up   */
+/* within its clip, instead of all of them.  */
+/* The wrapper is checked by running its     */
+/* code on a tiny interpreter, that knows    */
+/* only operators that cannot draw or move   */
+/* the image elsewhere: anything else means  */
+/* the input is copied whole, as always.     */
+/*********************************************/
+#define T_END	0
+#define T_BAD	1
+#define T_NUM	2
+#define T_NAME	3
+#define T_LIT	4	/* literal name, string */
+#define T_PROC	5
+#define T_OPEN	6	/* [ and << */
+#define T_CLOSE	7	/* ] */
+#define T_DCLOSE 8	/* >> */
+#define T_PCLOSE 9	/* } */
+
+#define MaxStack 64
+#define MaxGsave 16
+
+struct psitem {
+	int type;		/* T_NUM, T_PROC, T_OPEN (a mark), or T_LIT */
+	double num[6];		/* a number, or an array of six */
+	int isarray, isbool;
+	size_t off, end;	/* its text */
+	long seq;		/* token count */
+};
+
+/* operators without effect on the image, with their operand counts */
+static struct { char *name; int npop, npush; } psharmless[] = {
+	{ "def", 2, 0 },	{ "bind", 1, 1 },	{ "string", 1, 1 },
+	{ "pop", 1, 0 },	{ "dict", 1, 1 },	{ "begin", 1, 0 },
+	{ "end", 0, 0 },	{ "load", 1, 1 },	{ "userdict", 0, 1 },
+	{ "currentdict", 0, 1 },	{ "setgray", 1, 0 },
+	{ "setrgbcolor", 3, 0 },	{ "setcmykcolor", 4, 0 },
+	{ "setlinewidth", 1, 0 },	{ "newpath", 0, 0 },
+	{ NULL, 0, 0 }
+};
+
+/* recognise the image, fill in job->image when found */
+static void findimage( struct poster_job *job)
+{
+	struct poster_image *im = &job->image;
+	struct psitem st[MaxStack], *it;
+	struct psitem h;
+	double ctm[6] = { 1, 0, 0, 1, 0, 0 }, saved[MaxGsave][6], m[6];
+	char *inbuf = job->inbuf, name[16];
+	size_t pos, end, tok;
+	long seq = 0;
+	int sp = 0, nsaved = 0, i, j, k, t, n;
+
+	memset( im, 0, sizeof( *im));
+	for (i = 0; i < job->nspans; i++)
+	{	pos = job->spans[i].off;
+		end = pos + job->spans[i].len;
+		while ((t = pstoken( inbuf, &pos, end, &tok)) != T_END)
+		{	seq++;
+			if (t == T_BAD || t == T_PCLOSE)
+				return;
+			if (t != T_NAME && t != T_CLOSE && t != T_DCLOSE)
+			{	if (sp == MaxStack)
+					return;
+				it = st + sp++;
+				memset( it, 0, sizeof( *it));
+				it->type = t;
+				if (t == T_NUM)
+					it->num[0] = strtod( inbuf + tok, NULL);
+				it->off = tok;
+				it->end = pos;
+				it->seq = seq;
+				continue;
+			}
+			if (t != T_NAME)
+			{	/* ] or >>: make an array from the mark on */
+				for (j = sp-1; j >= 0 && st[j].type != T_OPEN; j--);
+				if (j < 0)
+					return;
+				n = sp - j - 1;
+				it = st + j;
+				it->isarray = t == T_CLOSE && n == 6;
+				for (k = 0; k < n; k++)
+				{	if (st[j+1+k].type != T_NUM || st[j+1+k].isarray)
+						it->isarray = 0;
+					else if (k < 6)
+						it->num[k] = st[j+1+k].num[0];
+				}
+				it->type = it->isarray ? T_NUM : T_LIT;
+				it->end = pos;
+				sp = j + 1;
+				continue;
+			}
+
+			/* an operator */
+			n = pos - tok < sizeof( name) ? pos - tok : sizeof( name) - 1;
+			memcpy( name, inbuf + tok, n);
+			name[n] = '\0';
+			if (!strcmp( name, "image") || !strcmp( name, "colorimage"))
+			{	imagecall( job, st, sp, seq, name[0] == 'c', ctm, pos);
+				return;
+			}
+			if (!strcmp( name, "true") || !strcmp( name, "false"))
+			{	if (sp == MaxStack)
+					return;
+				it = st + sp++;
+				memset( it, 0, sizeof( *it));
+				it->type = T_LIT;
+				it->isbool = 1;
+				it->num[0] = name[0] == 't';
+				it->off = tok;
+				it->end = pos;
+				it->seq = seq;
+			}
+			else if (!strcmp( name, "translate") || !strcmp( name, "scale"))
+			{	if (sp < 2 || st[sp-1].type != T_NUM || st[sp-1].isarray ||
+				    st[sp-2].type != T_NUM || st[sp-2].isarray)
+					return;
+				m[0] = m[3] = 1;
+				m[1] = m[2] = m[4] = m[5] = 0;
+				if (name[0] == 't')
+				{	m[4] = st[sp-2].num[0];
+					m[5] = st[sp-1].num[0];
+				} else
+				{	m[0] = st[sp-2].num[0];
+					m[3] = st[sp-1].num[0];
+				}
+				sp -= 2;
+				concat( ctm, m);
+			}
+			else if (!strcmp( name, "concat"))
+			{	if (sp < 1 || !st[sp-1].isarray)
+					return;
+				concat( ctm, st[--sp].num);
+			}
+			else if (!strcmp( name, "gsave") || !strcmp( name, "save"))
+			{	if (nsaved == MaxGsave || (name[0] == 's' && sp == MaxStack))
+					return;
+				memcpy( saved[nsaved++], ctm, sizeof( ctm));
+				if (name[0] == 's')
+				{	it = st + sp++;
+					memset( it, 0, sizeof( *it));
+					it->type = T_LIT;
+					it->seq = seq;
+				}
+			}
+			else if (!strcmp( name, "grestore") || !strcmp( name, "restore"))
+			{	if (nsaved == 0 || (name[0] == 'r' && sp < 1))
+					return;
+				memcpy( ctm, saved[--nsaved], sizeof( ctm));
+				if (name[0] == 'r')
+					sp--;
+			}
+			else if (!strcmp( name, "exch"))
+			{	if (sp < 2)
+					return;
+				h = st[sp-1];
+				st[sp-1] = st[sp-2];
+				st[sp-2] = h;
+			}
+			else if (!strcmp( name, "dup"))
+			{	if (sp < 1 || sp == MaxStack)
+					return;
+				st[sp] = st[sp-1];
+				sp++;
+			}
+			else
+			{	for (k = 0; psharmless[k].name &&
+					    strcmp( psharmless[k].name, name); k++);
+				if (!psharmless[k].name || sp < psharmless[k].npop ||
+				    sp - psharmless[k].npop + psharmless[k].npush > MaxStack)
+					return;
+				if (strcmp( name, "bind"))
+				{	sp -= psharmless[k].npop;
+					for (j = 0; j < psharmless[k].npush; j++)
+					{	it = st + sp++;
+						memset( it, 0, sizeof( *it));
+						it->type = T_LIT;
+						it->seq = seq;
+					}
+				}
+			}
+		}
+	}
+}
+
+/* the operands of an image or colorimage operator (ending at pos) */
+/* are on the stack: check that it is the one image we can crop */
+static void imagecall( struct poster_job *job, struct psitem *st, int sp,
+		       long seq, int color, double *ctm, size_t pos)
+{
+	struct poster_image *im = &job->image;
+	struct psitem *w;
+	char *inbuf = job->inbuf;
+	size_t p, end, tok, limit;
+	int nops = color ? 7 : 5, t, i;
+	long bytes, need, left;
+
+	/* W H bpc [matrix] {proc} [false ncomp] operator, in a row */
+	if (sp < nops)
+		return;
+	w = st + sp - nops;
+	if (w[0].type != T_NUM || w[0].isarray || w[1].type != T_NUM ||
+	    w[1].isarray || w[2].type != T_NUM || w[2].isarray ||
+	    !w[3].isarray || w[4].type != T_PROC ||
+	    seq != w[0].seq + nops + 7)
+		return;
+	if (color && (!w[5].isbool || w[5].num[0] ||
+		      w[6].type != T_NUM || w[6].isarray))
+		return;
+	im->width = w[0].num[0];
+	im->height = w[1].num[0];
+	im->bpc = w[2].num[0];
+	im->ncomp = color ? w[6].num[0] : 1;
+	im->colorimage = color;
+	if (im->width <= 0 || im->width != w[0].num[0] ||
+	    im->height <= 0 || im->height != w[1].num[0] ||
+	    (im->bpc != 1 && im->bpc != 2 && im->bpc != 4 &&
+	     im->bpc != 8 && im->bpc != 12) ||
+	    (im->ncomp != 1 && im->ncomp != 3 && im->ncomp != 4))
+		return;
+	memcpy( im->matrix, w[3].num, sizeof( im->matrix));
+	memcpy( im->ctm, ctm, sizeof( im->ctm));
+	if (im->matrix[1] != 0 || im->matrix[2] != 0 ||
+	    im->matrix[0] == 0 || im->matrix[3] == 0 ||
+	    ctm[1] != 0 || ctm[2] != 0 || ctm[0] == 0 || ctm[3] == 0)
+		return;
+
+	/* {currentfile name readhexstring pop} */
+	p = w[4].off + 1;
+	end = w[4].end;
+	if (pstoken( inbuf, &p, end, &tok) != T_NAME ||
+	    p - tok != 11 || strncmp( inbuf + tok, "currentfile", 11) ||
+	    pstoken( inbuf, &p, end, &tok) != T_NAME ||
+	    pstoken( inbuf, &p, end, &tok) != T_NAME)
+		return;
+	if (p - tok == 13 && !strncmp( inbuf + tok, "readhexstring", 13))
+		im->hex = 1;
+	else if (p - tok != 10 || strncmp( inbuf + tok, "readstring", 10))
+		return;
+	if (pstoken( inbuf, &p, end, &tok) != T_NAME ||
+	    p - tok != 3 || strncmp( inbuf + tok, "pop", 3) ||
+	    pstoken( inbuf, &p, end, &tok) != T_PCLOSE)
+		return;
+
+	/* the samples follow the operator, within its range of input */
+	for (i = 0; i < job->nspans && job->spans[i].off + job->spans[i].len < pos; i++);
+	if (i == job->nspans)
+		return;
+	limit = job->spans[i].off + job->spans[i].len;
+	bytes = ((long)im->width * im->ncomp * im->bpc + 7) / 8 * im->height;
+	if (pos >= limit || !isspace( (unsigned char)inbuf[pos]))
+		return;
+	if (!im->hex)
+	{	/* binary: right after the one white space character */
+		p = pos + 1;
+		if (inbuf[pos] == '\r' && p < limit && inbuf[p] == '\n')
+			p++;
+		if (bytes > (long)(limit - p))
+			return;
+		im->dataoff = p;
+		im->dataend = p + bytes;
+	} else
+	{	/* hex: lines of equal length, so that any sample */
+		/* can be found without reading them all */
+		for (p = pos; p < limit && isspace( (unsigned char)inbuf[p]); p++);
+		im->dataoff = p;
+		for (; p < limit && isxdigit( (unsigned char)inbuf[p]); p++);
+		im->linelen = p - im->dataoff;
+		need = 2 * bytes;
+		if (im->linelen == 0)
+			return;
+		if (need <= im->linelen)
+			im->dataend = im->dataoff + need;
+		else
+		{	if (p < limit && inbuf[p] == '\r' && p+1 < limit && inbuf[p+1] == '\n')
+				im->eollen = 2;
+			else if (p < limit && (inbuf[p] == '\n' || inbuf[p] == '\r'))
+				im->eollen = 1;
+			else	return;
+			for (left = need, p = im->dataoff; left > 0; left -= t)
+			{	t = left < im->linelen ? left : im->linelen;
+				if (p + t > limit)
+					return;
+				for (i = 0; i < t; i++)
+					if (!isxdigit( (unsigned char)inbuf[p+i]))
+						return;
+				if (left > im->linelen)
+				{	if (p + t + im->eollen > limit ||
+					    inbuf[p+t] != inbuf[im->dataoff + im->linelen] ||
+					    (im->eollen == 2 && inbuf[p+t+1] != '\n'))
+						return;
+					p += t + im->eollen;
+				} else
+					p += t;
+			}
+			im->dataend = p;
+		}
+	}
+
+	/* and it should be the only image */
+	for (i = 0; i < job->nspans; i++)
+	{	char *c;
+
+		p = job->spans[i].off;
+		end = p + job->spans[i].len;
+		if (p < im->dataend)
+			p = im->dataend;
+		for (; p + 5 <= end; p++)
+		{	if (!(c = memchr( inbuf + p, 'i', end - p - 4)))
+				break;
+			p = c - inbuf;
+			if (!strncmp( inbuf + p, "image", 5))
+				return;
+		}
+	}
+
+	im->start = w[0].off;
+	im->found = 1;
+	note( job, 1, "Input is a %dx%d image%s\n", im->width, im->height,
+		cropping( job) ? ", each tile gets its own part of it" : "");
+}
+
+/* the next PostScript token in [*pos,end): its kind, and its text [*tok,*pos) */
+static int pstoken( char *buf, size_t *pos, size_t end, size_t *tok)
+{
+	size_t p = *pos, t;
+	int depth, r;
+
+	for (;;)
+	{	while (p < end && isspace( (unsigned char)buf[p]))
+			p++;
+		if (p < end && buf[p] == '%')
+		{	while (p < end && buf[p] != '\n' && buf[p] != '\r')
+				p++;
+			continue;
+		}
+		break;
+	}
+	*tok = p;
+	if (p >= end)
+		return T_END;
+
+	r = T_BAD;
+	switch (buf[p])
+	{ case '(':
+		for (depth = 0; p < end; p++)
+			if (buf[p] == '\\')
+				p++;
+			else if (buf[p] == '(')
+				depth++;
+			else if (buf[p] == ')' && --depth == 0)
+			{	p++;
+				r = T_LIT;
+				break;
+			}
+		break;
+	  case '<':
+		if (p+1 < end && buf[p+1] == '<')
+		{	p += 2;
+			r = T_OPEN;
+		}
+		else
+		{	for (; p < end && buf[p] != '>'; p++);
+			if (p < end)
+			{	p++;
+				r = T_LIT;
+			}
+		}
+		break;
+	  case '>':
+		if (p+1 < end && buf[p+1] == '>')
+		{	p += 2;
+			r = T_DCLOSE;
+		}
+		break;
+	  case '[':	p++; r = T_OPEN; break;
+	  case ']':	p++; r = T_CLOSE; break;
+	  case '}':	p++; r = T_PCLOSE; break;
+	  case '{':
+		for (p++; (r = pstoken( buf, &p, end, &t)) != T_PCLOSE; )
+			if (r == T_END || r == T_BAD)
+				break;
+		if (r == T_PCLOSE)
+			r = T_PROC;
+		else	r = T_BAD;
+		break;
+	  case ')':
+		break;
+	  default:
+		t = p;
+		if (buf[p] == '/')
+			p++;
+		for (; p < end && !isspace( (unsigned char)buf[p]) &&
+		       !strchr( "()<>[]{}/%", buf[p]); p++);
+		if (buf[t] == '/')
+			r = T_LIT;
+		else
+		{	char *e;
+			strtod( buf + t, &e);
+			r = e == buf + p ? T_NUM : T_NAME;
+		}
+		break;
+	}
+	*pos = p;
+	return r;
+}
+
+/* m = m x ctm, for concat */
+static void concat( double *ctm, double *m)
+{
+	double n[6];
+
+	n[0] = m[0]*ctm[0] + m[1]*ctm[2];
+	n[1] = m[0]*ctm[1] + m[1]*ctm[3];
+	n[2] = m[2]*ctm[0] + m[3]*ctm[2];
+	n[3] = m[2]*ctm[1] + m[3]*ctm[3];
+	n[4] = m[4]*ctm[0] + m[5]*ctm[2] + ctm[4];
+	n[5] = m[4]*ctm[1] + m[5]*ctm[3] + ctm[5];
+	memcpy( ctm, n, sizeof( n));
+}
+
+/* the samples of the image that show on a tile: columns [i0,i1) */
+/* and rows [j0,j1); returns 0 when none do */
+static int imagecrop( struct poster_job *job, int row, int col, int crop[4])
+{
+	struct poster_image *im = &job->image;
+	double tw, th, r[4], u, v, x[2], y[2];
+	int k, bpp = im->ncomp * im->bpc;
+
+	/* the clip of the tile in poster units (see tileprolog), */
+	/* with its clipmargin of 6 */
+	tw = (int)(job->sheetsize[2] - 2.0*job->sheetmargin[0]);
+	th = (int)(job->sheetsize[3] - 2.0*job->sheetmargin[1]);
+	if (job->rotate)
+		exch( tw, th);
+	r[0] = tw * (col-1) - 6;
+	r[1] = th * (row-1) - 6;
+	r[2] = tw * col + 6;
+	r[3] = th * row + 6;
+
+	/* into input units, into image space */
+	for (k = 0; k < 2; k++)
+	{	u = (int)job->imagebb[0] + (r[2*k] - (int)job->posterbb[0]) / job->scale;
+		v = (int)job->imagebb[1] + (r[2*k+1] - (int)job->posterbb[1]) / job->scale;
+		u = (u - im->ctm[4]) / im->ctm[0];
+		v = (v - im->ctm[5]) / im->ctm[3];
+		x[k] = im->matrix[0] * u + im->matrix[4];
+		y[k] = im->matrix[3] * v + im->matrix[5];
+	}
+	if (x[0] > x[1]) exch( x[0], x[1]);
+	if (y[0] > y[1]) exch( y[0], y[1]);
+
+	/* a sample more all around, for smoothing devices */
+	crop[0] = clampfloor( x[0] - 1, im->width);
+	crop[1] = clampceil( x[1] + 1, im->width);
+	crop[2] = clampfloor( y[0] - 1, im->height);
+	crop[3] = clampceil( y[1] + 1, im->height);
+	/* rows of samples start at a byte */
+	while ((crop[0] * bpp) % 8)
+		crop[0]--;
+	return crop[0] < crop[1] && crop[2] < crop[3];
+}
+
+/* x rounded down or up, within [0,max] */
+static int clampfloor( double x, int max)
+{
+	return x <= 0 ? 0 : x >= max ? max : (int)floor( x);
+}
+
+static int clampceil( double x, int max)
+{
+	return x <= 0 ? 0 : x >= max ? max : (int)ceil( x);
+}
+
+/* copy the input, but only the part of the image that shows on the tile */
+/* without out only return the bytes that would be printed */
+static long printimage( struct poster_job *job, struct out *out, int row, int col)
+{
+	struct poster_image *im = &job->image;
+	int crop[4], bpp = im->ncomp * im->bpc, j;
+	long rowbytes = ((long)im->width * bpp + 7) / 8;
+	long b0, n, k, l, size;
+	char *data = job->inbuf + im->dataoff;
+	char buf[BUFSIZE];
+
+	size = copyrange( job, out, 0, im->start);
+	if (imagecrop( job, row, col, crop))
+	{	b0 = (long)crop[0] * bpp / 8;
+		n = ((long)(crop[1] - crop[0]) * bpp + 7) / 8;
+		l = snprintf( buf, BUFSIZE, "/tilepicstr %ld string def\n"
+			"%d %d %d [%.10g 0 0 %.10g %.10g %.10g]\n"
+			"{currentfile tilepicstr %s pop}\n%s\n",
+			n, crop[1] - crop[0], crop[3] - crop[2], im->bpc,
+			im->matrix[0], im->matrix[3],
+			im->matrix[4] - crop[0], im->matrix[5] - crop[2],
+			im->hex ? "readhexstring" : "readstring",
+			im->colorimage ? (im->ncomp == 3 ? "false 3 colorimage" :
+			"false 4 colorimage") : "image");
+		if (out)
+			owrite( out, buf, l);
+		size += l;
+
+		for (j = crop[2]; j < crop[3]; j++)
+		{	if (!im->hex)
+			{	if (out)
+					owrite( out, data + j*rowbytes + b0, n);
+				size += n;
+				continue;
+			}
+			/* hex digits [k,k+2n) of the data, as they are on the lines */
+			for (k = 2*(j*rowbytes + b0), l = 2*n; l > 0; )
+			{	long line = k / im->linelen, off = k % im->linelen;
+				long t = im->linelen - off < l ? im->linelen - off : l;
+
+				if (out)
+				{	owrite( out, data + line * (im->linelen + im->eollen) + off, t);
+					owrite( out, "\n", 1);
+				}
+				size += t + 1;
+				k += t;
+				l -= t;
+			}
+		}
+		if (!im->hex)
+		{	if (out)
+				owrite( out, "\n", 1);
+			size++;
+		}
+	}
+	return size + copyrange( job, out, im->dataend, job->insize);
+}
+
+/* copy what is in the spans of [from,to) */
+static long copyrange( struct poster_job *job, struct out *out, size_t from, size_t to)
+{
+	struct poster_span *sp, *r = job->resources;
+	struct poster_span *rend = r + (hoisting( job) ? job->nresources : 0);
+	size_t a, b, c;
+	long size = 0;
+	int i;
+
+	for (i = 0, sp = job->spans; i < job->nspans; i++, sp++)
+	{	a = sp->off < from ? from : sp->off;
+		b = sp->off + sp->len > to ? to : sp->off + sp->len;
+		while (a < b)
+		{	/* up to the next resource sent in the setup, if any */
+			while (r < rend && r->off + r->len <= a)
+				r++;
+			c = r < rend && r->off < b ? r->off : b;
+			if (c > a)
+			{	if (out)
+					owrite( out, job->inbuf + a, c - a);
+				size += c - a;
+			}
+			a = c < b ? r->off + r->len : b;
+		}
+	}
+	return size;
+}
+
+/*********************************************/
+/* PDF input: a minimal reader of the xref   */
+/* and the objects, enough to find the pages */
+/* and copy a page with all that it uses.    */
+/* The output is PDF too: each page of the   */
+/* input once, as a form XObject, and a      */
+/* sheet per tile that draws it the way      */
+/* tileprolog and tileepilog do.             */
+/* Streams are copied as they are; only a    */
+/* page with several content streams gets    */
+/* them inflated and joined into one.        */
+/*********************************************/
+#define PdfMaxDepth 64		/* of the page tree and of references */
+
+/* where an object is */
+struct pdfxref {
+	char type;		/* 0 unknown, 'f' free, 'n' in the file at off, */
+	size_t off;		/* 'c' number idx in object stream stm */
+	int stm, idx;
+};
+
+/* a value in a buffer: the input, or a decoded object stream */
+struct pdfval {
+	const char *b;
+	size_t p, e;		/* the value is b[p..e) */
+	size_t size;		/* b holds size bytes: a stream may follow e */
+};
+
+struct pdfpage {
+	int obj;		/* object number of the page */
+	struct pdfval res;	/* its resources, maybe inherited */
+	struct pdfval contents;	/* its content stream(s) */
+	int gotres, gotcontents;
+	double box[4];		/* its crop box */
+	int rotate;		/* its /Rotate: 0, 90, 180 or 270 */
+};
+
+struct poster_pdf {
+	char version[4];	/* as in %PDF-1.7 */
+	struct pdfxref *xref;
+	int nobj;
+	char **stmdata;		/* decoded object streams, by object number */
+	size_t *stmlen;
+	int rootobj;		/* the catalog */
+	struct pdfpage *pages;
+	int npages, maxpages;
+};
+
+/* an output document under construction */
+struct pdfout {
+	struct poster_pdf *pdf;
+	int *renum;		/* output number of each input object, */
+				/* 0 for not yet, -1 for never */
+	int *queue, nqueue;	/* input objects still to copy */
+	size_t *offs;		/* where each output object is */
+	int nout, maxout;
+};
+
+static int pdfspace( int c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t' ||
+		c == '\f' || c == '\0';
+}
+
+static int pdfdelim( int c)
+{
+	return c && strchr( "()<>[]{}/%", c) != NULL;
+}
+
+/* skip white space and comments */
+static size_t pdf_ws( const char *b, size_t p, size_t end)
+{
+	while (p < end)
+	{	if (pdfspace( b[p]))
+			p++;
+		else if (b[p] == '%')
+		{	while (p < end && b[p] != '\n' && b[p] != '\r')
+				p++;
+		} else	break;
+	}
+	return p;
+}
+
+/* the end of the token at p: a name, number, keyword, */
+/* string or one of << >> [ ] { } */
+static size_t pdf_token( const char *b, size_t p, size_t end)
+{
+	int depth;
+
+	if (p >= end)
+		return end;
+	switch (b[p])
+	{ case '(':
+		for (depth = 0; p < end; p++)
+		{	if (b[p] == '\\') p++;
+			else if (b[p] == '(') depth++;
+			else if (b[p] == ')' && --depth == 0) return p+1;
+		}
+		return end;
+	  case '<':
+		if (p+1 < end && b[p+1] == '<')
+			return p+2;
+		while (p < end && b[p] != '>') p++;
+		return p < end ? p+1 : end;
+	  case '>':
+		return p+1 < end && b[p+1] == '>' ? p+2 : p+1;
+	  case '[': case ']': case '{': case '}': case ')':
+		return p+1;
+	  case '/':
+		p++;
+	}
+	while (p < end && !pdfspace( b[p]) && !pdfdelim( b[p]))
+		p++;
+	return p;
+}
+
+/* is the token at p this keyword or name? */
+static int pdf_is( const char *b, size_t p, size_t end, const char *word)
+{
+	size_t l = strlen( word);
+
+	return pdf_token( b, p, end) == p + l && !memcmp( b + p, word, l);
+}
+
+/* an unsigned integer at *p (after white space), moving *p past it */
+static int pdf_num( const char *b, size_t *p, size_t end, long *x)
+{
+	size_t q = pdf_ws( b, *p, end);
+
+	if (q >= end || !isdigit( (unsigned char)b[q]))
+		return -1;
+	for (*x = 0; q < end && isdigit( (unsigned char)b[q]); q++)
+		*x = 10 * *x + b[q] - '0';
+	*p = q;
+	return 0;
+}
+
+/* is there a reference 'num gen R' at p? */
+static int pdf_isref( const char *b, size_t p, size_t end, long *num, size_t *next)
+{
+	long gen;
+
+	if (pdf_num( b, &p, end, num) < 0 || p >= end || !pdfspace( b[p]) ||
+	    pdf_num( b, &p, end, &gen) < 0)
+		return 0;
+	p = pdf_ws( b, p, end);
+	if (!pdf_is( b, p, end, "R"))
+		return 0;
+	*next = p+1;
+	return 1;
+}
+
+/* the end of the complete value at p */
+static size_t pdf_value( const char *b, size_t p, size_t end)
+{
+	size_t q;
+	long num;
+	char close;
+
+	if (p >= end)
+		return end;
+	if ((b[p] == '<' && p+1 < end && b[p+1] == '<') || b[p] == '[')
+	{	close = b[p] == '[' ? ']' : '>';
+		for (p = pdf_token( b, p, end);; p = pdf_value( b, p, end))
+		{	p = pdf_ws( b, p, end);
+			if (p >= end)
+				return end;
+			if (b[p] == close)
+				return pdf_token( b, p, end);
+		}
+	}
+	if (isdigit( (unsigned char)b[p]) && pdf_isref( b, p, end, &num, &q))
+		return q;
+	return pdf_token( b, p, end);
+}
+
+/* object num, as the value after 'num gen obj' */
+static int pdf_object( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       long num, struct pdfval *v)
+{
+	struct pdfxref *x;
+	struct pdfval stm;
+	size_t p;
+	long n, off, first;
+	int i;
+
+	if (num <= 0 || num >= pdf->nobj)
+		return -1;
+	x = pdf->xref + num;
+	if (x->type == 'n')
+	{	p = x->off;
+		if (pdf_num( inbuf, &p, insize, &n) < 0 || n != num ||
+		    pdf_num( inbuf, &p, insize, &n) < 0)
+			return -1;
+		p = pdf_ws( inbuf, p, insize);
+		if (!pdf_is( inbuf, p, insize, "obj"))
+			return -1;
+		v->b = inbuf;
+		v->size = insize;
+		v->p = pdf_ws( inbuf, p+3, insize);
+		v->e = pdf_value( inbuf, v->p, insize);
+		return 0;
+	}
+	if (x->type != 'c' || x->idx < 0 || !pdf->stmdata[x->stm] ||
+	    pdf_object( pdf, inbuf, insize, x->stm, &stm) < 0 ||
+	    pdf_getnum( pdf, inbuf, insize, &stm, "/First", &first) < 0)
+		return -1;
+
+	/* the object stream starts with pairs of number and offset */
+	v->b = pdf->stmdata[x->stm];
+	v->size = pdf->stmlen[x->stm];
+	for (p = i = 0; i <= x->idx; i++)
+		if (pdf_num( v->b, &p, v->size, &n) < 0 ||
+		    pdf_num( v->b, &p, v->size, &off) < 0)
+			return -1;
+	if (n != num || first + off >= v->size)
+		return -1;
+	v->p = pdf_ws( v->b, first + off, v->size);
+	v->e = pdf_value( v->b, v->p, v->size);
+	return 0;
+}
+
+/* follow references, to the value itself */
+static int pdf_resolve( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+			struct pdfval *v)
+{
+	size_t q;
+	long num;
+	int depth;
+
+	for (depth = 0; depth < PdfMaxDepth; depth++)
+	{	if (!pdf_isref( v->b, v->p, v->e, &num, &q))
+			return 0;
+		if (pdf_object( pdf, inbuf, insize, num, v) < 0)
+			return -1;
+	}
+	return -1;
+}
+
+/* the value of key in dictionary dict, as it is there */
+static int pdf_get( struct pdfval *dict, char *key, struct pdfval *v)
+{
+	const char *b = dict->b;
+	size_t p = dict->p, k;
+
+	if (p+1 >= dict->e || b[p] != '<' || b[p+1] != '<')
+		return -1;
+	for (p += 2;; p = v->e)
+	{	p = pdf_ws( b, p, dict->e);
+		if (p >= dict->e || b[p] != '/')
+			return -1;
+		k = p;
+		p = pdf_token( b, p, dict->e);
+		*v = *dict;
+		v->p = pdf_ws( b, p, dict->e);
+		v->e = pdf_value( b, v->p, dict->e);
+		if (p - k == strlen( key) && !memcmp( b + k, key, p - k))
+			return 0;
+	}
+}
+
+/* ...with the references followed */
+static int pdf_lookup( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       struct pdfval *dict, char *key, struct pdfval *v)
+{
+	if (pdf_get( dict, key, v) < 0)
+		return -1;
+	return pdf_resolve( pdf, inbuf, insize, v);
+}
+
+static int pdf_getnum( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       struct pdfval *dict, char *key, long *x)
+{
+	struct pdfval v;
+	size_t p;
+
+	if (pdf_lookup( pdf, inbuf, insize, dict, key, &v) < 0)
+		return -1;
+	p = v.p;
+	return pdf_num( v.b, &p, v.e, x);
+}
+
+/* a real number */
+static int pdf_real( struct pdfval *v, double *x)
+{
+	char buf[64], *end;
+	size_t l = v->e - v->p;
+
+	if (l == 0 || l >= sizeof( buf))
+		return -1;
+	memcpy( buf, v->b + v->p, l);
+	buf[l] = '\0';
+	*x = strtod( buf, &end);
+	return *end ? -1 : 0;
+}
+
+/* the next element of array arr, from *pos on */
+static int pdf_next( struct pdfval *arr, size_t *pos, struct pdfval *v)
+{
+	if (*pos == 0)
+	{	if (arr->p >= arr->e || arr->b[arr->p] != '[')
+			return -1;
+		*pos = arr->p + 1;
+	}
+	*v = *arr;
+	v->p = pdf_ws( arr->b, *pos, arr->e);
+	if (v->p >= arr->e || arr->b[v->p] == ']')
+		return -1;
+	*pos = v->e = pdf_value( arr->b, v->p, arr->e);
+	return 0;
+}
+
+/* the raw data of the stream object v */
+static int pdf_stream( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       struct pdfval *v, const char **data, size_t *len)
+{
+	const char *b = v->b;
+	size_t p = pdf_ws( b, v->e, v->size), q;
+	long length;
+
+	if (!pdf_is( b, p, v->size, "stream"))
+		return -1;
+	p += 6;
+	if (p < v->size && b[p] == '\r') p++;
+	if (p < v->size && b[p] == '\n') p++;
+	*data = b + p;
+
+	/* trust /Length when endstream follows it */
+	if (pdf_getnum( pdf, inbuf, insize, v, "/Length", &length) == 0 &&
+	    length <= v->size - p)
+	{	q = pdf_ws( b, p + length, v->size);
+		if (pdf_is( b, q, v->size, "endstream"))
+		{	*len = length;
+			return 0;
+		}
+	}
+	for (q = p; q + 9 <= v->size; q++)
+		if (b[q] == 'e' && !memcmp( b + q, "endstream", 9))
+		{	if (q > p && b[q-1] == '\n') q--;
+			if (q > p && b[q-1] == '\r') q--;
+			*len = q - p;
+			return 0;
+		}
+	return -1;
+}
+
+/* inflate n bytes at p into a malloc()ed buffer */
+static int pdf_inflate( const char *p, size_t n, char **out, size_t *outlen)
+{
+	z_stream zs;
+	size_t alloc = 4*n + 1024;
+	char *buf, *nbuf;
+	int r;
+
+	memset( &zs, 0, sizeof( zs));
+	if (!(buf = malloc( alloc)))
+		return -1;
+	if (inflateInit( &zs) != Z_OK)
+	{	free( buf);
+		return -1;
+	}
+	zs.next_in = (Bytef *)p;
+	zs.avail_in = n;
+	do
+	{	if (zs.total_out == alloc)
+		{	if (!(nbuf = realloc( buf, alloc *= 2)))
+			{	r = Z_MEM_ERROR;
+				break;
+			}
+			buf = nbuf;
+		}
+		zs.next_out = (Bytef *)buf + zs.total_out;
+		zs.avail_out = alloc - zs.total_out;
+		r = inflate( &zs, Z_NO_FLUSH);
+	} while (r == Z_OK || (r == Z_BUF_ERROR && zs.avail_out == 0));
+	*outlen = zs.total_out;
+	inflateEnd( &zs);
+	/* a stream that just stops is taken as it is */
+	if (r != Z_STREAM_END && !(r == Z_BUF_ERROR && zs.avail_in == 0))
+	{	free( buf);
+		return -1;
+	}
+	*out = buf;
+	return 0;
+}
+
+/* undo a PNG predictor, in place */
+static int pdf_predictor( char *data, size_t *len, long colors, long bpc,
+			  long columns)
+{
+	unsigned char *d = (unsigned char *)data, *in, *row, *prev;
+	size_t bpp = (colors * bpc + 7) / 8, rowlen = (colors * bpc * columns + 7) / 8;
+	size_t nrows = *len / (rowlen + 1), i, k;
+	int a, b, c, pa, pb, pc, pr, type;
+
+	if (colors < 1 || bpc < 1 || columns < 1)
+		return -1;
+	for (i = 0; i < nrows; i++)
+	{	in = d + i * (rowlen + 1);
+		row = d + i * rowlen;
+		prev = i ? row - rowlen : NULL;
+		type = in[0];	/* before row overwrites it */
+		for (k = 0; k < rowlen; k++)
+		{	a = k >= bpp ? row[k - bpp] : 0;
+			b = prev ? prev[k] : 0;
+			c = prev && k >= bpp ? prev[k - bpp] : 0;
+			switch (type)
+			{ case 0: pr = 0; break;
+			  case 1: pr = a; break;
+			  case 2: pr = b; break;
+			  case 3: pr = (a + b) / 2; break;
+			  case 4:
+				pa = abs( b - c); pb = abs( a - c); pc = abs( a + b - 2*c);
+				pr = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+				break;
+			  default: return -1;
+			}
+			row[k] = in[k+1] + pr;
+		}
+	}
+	*len = nrows * rowlen;
+	return 0;
+}
+
+/* the decoded data of stream object v, malloc()ed: */
+/* only unfiltered and FlateDecode streams. */
+/* Without out, only whether it can be decoded */
+static int pdf_decode( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		       struct pdfval *v, char **out, size_t *outlen)
+{
+	struct pdfval f, arr, parms;
+	const char *data;
+	size_t len, pos = 0;
+	long pred = 1, colors = 1, bpc = 8, columns = 1;
+
+	if (pdf_stream( pdf, inbuf, insize, v, &data, &len) < 0)
+		return -1;
+	if (pdf_lookup( pdf, inbuf, insize, v, "/Filter", &f) < 0)
+	{	/* as it is */
+		if (!out)
+			return 0;
+		if (!(*out = malloc( len + 1)))
+			return -1;
+		memcpy( *out, data, len);
+		*outlen = len;
+		return 0;
+	}
+	if (f.b[f.p] == '[')
+	{	arr = f;
+		if (pdf_next( &arr, &pos, &f) < 0 || pdf_next( &arr, &pos, &parms) == 0)
+			return -1;	/* not exactly one filter */
+	}
+	if (!pdf_is( f.b, f.p, f.e, "/FlateDecode") && !pdf_is( f.b, f.p, f.e, "/Fl"))
+		return -1;
+	if (!out)
+		return 0;
+	if (pdf_inflate( data, len, out, outlen) < 0)
+		return -1;
+
+	pos = 0;
+	if (pdf_lookup( pdf, inbuf, insize, v, "/DecodeParms", &parms) == 0 &&
+	    (parms.b[parms.p] != '[' ||
+	     (pdf_next( &parms, &pos, &parms) == 0 &&
+	      pdf_resolve( pdf, inbuf, insize, &parms) == 0)))
+	{	pdf_getnum( pdf, inbuf, insize, &parms, "/Predictor", &pred);
+		pdf_getnum( pdf, inbuf, insize, &parms, "/Colors", &colors);
+		pdf_getnum( pdf, inbuf, insize, &parms, "/BitsPerComponent", &bpc);
+		pdf_getnum( pdf, inbuf, insize, &parms, "/Columns", &columns);
+	}
+	if (pred >= 10 ? pdf_predictor( *out, outlen, colors, bpc, columns) < 0 :
+	    pred != 1)
+	{	free( *out);
+		return -1;
+	}
+	return 0;
+}
+
+/* note where object num is, unless a newer xref section did */
+static int pdf_setxref( struct poster_pdf *pdf, long num, char type,
+			size_t off, int stm, int idx)
+{
+	struct pdfxref *x;
+	int n;
+
+	if (num < 0 || num > 8*1024*1024)
+		return -1;
+	if (num >= pdf->nobj)
+	{	n = num + 1 > 2 * pdf->nobj ? num + 1 : 2 * pdf->nobj;
+		if (!(x = realloc( pdf->xref, n * sizeof( *x))))
+			return -1;
+		memset( x + pdf->nobj, 0, (n - pdf->nobj) * sizeof( *x));
+		pdf->xref = x;
+		pdf->nobj = n;
+	}
+	x = pdf->xref + num;
+	if (!x->type)
+	{	x->type = type;
+		x->off = off;
+		x->stm = stm;
+		x->idx = idx;
+	}
+	return 0;
+}
+
+/* the trailer dictionary t of an xref section: */
+/* the newest says where the catalog is */
+static int pdf_trailer( struct poster_job *job, struct pdfval *t)
+{
+	struct pdfval v;
+	long root;
+	size_t q;
+
+	if (pdf_get( t, "/Encrypt", &v) == 0)
+		return fail( job, "Cannot read encrypted PDF '%s'!", job->inname);
+	if (!job->pdf->rootobj && pdf_get( t, "/Root", &v) == 0 &&
+	    pdf_isref( v.b, v.p, v.e, &root, &q))
+		job->pdf->rootobj = root;
+	return 0;
+}
+
+/* the xref stream at off; its dictionary is the trailer */
+static int pdf_xrefstream( struct poster_job *job, size_t off, long *prev)
+{
+	struct poster_pdf *pdf = job->pdf;
+	struct pdfval v, w, idx, e;
+	char *data;
+	size_t len, p, pos = 0, ipos = 0;
+	long num, n, wd[3], f[3], first, count;
+	int i, k, sect, r = 0;
+
+	p = off;
+	if (pdf_num( job->inbuf, &p, job->insize, &num) < 0 ||
+	    pdf_setxref( pdf, num, 'n', off, 0, 0) < 0 ||
+	    pdf_object( pdf, job->inbuf, job->insize, num, &v) < 0)
+		return -1;
+	if (pdf_trailer( job, &v) < 0)
+		return -2;
+	if (pdf_lookup( pdf, job->inbuf, job->insize, &v, "/W", &w) < 0)
+		return -1;
+	for (i = 0; i < 3; i++)
+	{	if (pdf_next( &w, &pos, &e) < 0 || (p = e.p,
+		    pdf_num( e.b, &p, e.e, &wd[i]) < 0) || wd[i] > 8)
+			return -1;
+	}
+	if (pdf_decode( pdf, job->inbuf, job->insize, &v, &data, &len) < 0)
+		return -1;
+	if (pdf_getnum( pdf, job->inbuf, job->insize, &v, "/Prev", prev) < 0)
+		*prev = -1;
+
+	/* /Index has pairs of first number and count, default 0 /Size */
+	if (pdf_lookup( pdf, job->inbuf, job->insize, &v, "/Index", &idx) < 0)
+		idx.b = NULL;
+	for (p = 0, sect = 0; r == 0; sect++)
+	{	if (idx.b)
+		{	if (pdf_next( &idx, &ipos, &e) < 0)
+				break;
+			pos = e.p;
+			if (pdf_num( e.b, &pos, e.e, &first) < 0 ||
+			    pdf_next( &idx, &ipos, &e) < 0)
+			{	r = -1;
+				break;
+			}
+			pos = e.p;
+			if (pdf_num( e.b, &pos, e.e, &count) < 0)
+			{	r = -1;
+				break;
+			}
+		} else if (sect > 0 ||
+			   pdf_getnum( pdf, job->inbuf, job->insize, &v, "/Size", &count) < 0)
+			break;
+		else	first = 0;
+
+		for (n = 0; n < count && p + wd[0] + wd[1] + wd[2] <= len; n++)
+		{	for (i = 0; i < 3; i++)
+				for (f[i] = k = 0; k < wd[i]; k++)
+					f[i] = (f[i] << 8) | (unsigned char)data[p++];
+			if (wd[0] == 0)
+				f[0] = 1;
+			if (f[0] == 0)
+				r = pdf_setxref( pdf, first + n, 'f', 0, 0, 0);
+			else if (f[0] == 1)
+				r = pdf_setxref( pdf, first + n, 'n', f[1], 0, 0);
+			else if (f[0] == 2)
+				r = pdf_setxref( pdf, first + n, 'c', 0, f[1], f[2]);
+			if (r < 0)
+				break;
+		}
+	}
+	free( data);
+	return r;
+}
+
+/* the xref table at off, with its trailer */
+static int pdf_xreftable( struct poster_job *job, size_t off, long *prev)
+{
+	const char *b = job->inbuf;
+	size_t p = pdf_ws( b, off, job->insize) + 4, end = job->insize;
+	struct pdfval t;
+	long first, count, n, o, gen;
+
+	for (;;)
+	{	p = pdf_ws( b, p, end);
+		if (pdf_is( b, p, end, "trailer"))
+			break;
+		if (pdf_num( b, &p, end, &first) < 0 ||
+		    pdf_num( b, &p, end, &count) < 0)
+			return -1;
+		for (n = 0; n < count; n++)
+		{	if (pdf_num( b, &p, end, &o) < 0 ||
+			    pdf_num( b, &p, end, &gen) < 0)
+				return -1;
+			p = pdf_ws( b, p, end);
+			if (p >= end ||
+			    pdf_setxref( job->pdf, first + n, b[p] == 'n' ? 'n' : 'f',
+					 o, 0, 0) < 0)
+				return -1;
+			p++;
+		}
+	}
+	t.b = b;
+	t.size = end;
+	t.p = pdf_ws( b, p + 7, end);
+	t.e = pdf_value( b, t.p, end);
+	if (pdf_trailer( job, &t) < 0)
+		return -2;
+	/* a hybrid file has the newer objects in an xref stream */
+	if (pdf_getnum( job->pdf, b, end, &t, "/XRefStm", &o) == 0 &&
+	    pdf_xrefstream( job, o, &n) == -2)
+		return -2;
+	if (pdf_getnum( job->pdf, b, end, &t, "/Prev", prev) < 0)
+		*prev = -1;
+	return 0;
+}
+
+/* read the xref sections, from the newest back to the oldest */
+static int pdf_xref( struct poster_job *job)
+{
+	const char *b = job->inbuf;
+	size_t p;
+	long off, prev;
+	int n, r;
+
+	for (p = job->insize > 9 ? job->insize - 9 : 0; p > 0; p--)
+		if (b[p] == 's' && !memcmp( b + p, "startxref", 9))
+			break;
+	p += 9;
+	if (pdf_num( b, &p, job->insize, &off) < 0)
+		return -1;
+	for (n = 0; off >= 0 && off < job->insize && n < PdfMaxDepth; n++, off = prev)
+	{	p = pdf_ws( b, off, job->insize);
+		if (pdf_is( b, p, job->insize, "xref"))
+			r = pdf_xreftable( job, p, &prev);
+		else	r = pdf_xrefstream( job, p, &prev);
+		if (r < 0)
+			return r;
+	}
+	return 0;
+}
+
+/* without a usable xref: find the objects by scanning the whole file */
+static int pdf_rebuild( struct poster_job *job)
+{
+	struct poster_pdf *pdf = job->pdf;
+	const char *b = job->inbuf;
+	size_t p, q, end = job->insize;
+	struct pdfval v, t;
+	long num, gen;
+
+	note( job, 1, "Rebuilding the xref of PDF '%s'\n", job->inname);
+	if (pdf->stmdata)
+		for (num = 0; num < pdf->nobj; num++)
+			free( pdf->stmdata[num]);
+	free( pdf->stmdata);
+	free( pdf->stmlen);
+	pdf->stmdata = NULL;
+	pdf->stmlen = NULL;
+	free( pdf->xref);
+	pdf->xref = NULL;
+	pdf->nobj = 0;
+	pdf->rootobj = 0;
+
+	/* 'num gen obj' at the start of a line; the last one counts */
+	for (p = 0; p < end; p++)
+	{	if (p > 0 && b[p-1] != '\n' && b[p-1] != '\r')
+			continue;
+		q = p;
+		if (isdigit( (unsigned char)b[p]) &&
+		    pdf_num( b, &q, end, &num) == 0 && pdf_num( b, &q, end, &gen) == 0 &&
+		    pdf_is( b, pdf_ws( b, q, end), end, "obj"))
+		{	if (num < pdf->nobj)
+				pdf->xref[num].type = 0;
+			if (pdf_setxref( pdf, num, 'n', p, 0, 0) < 0)
+				return -1;
+		} else if (pdf_is( b, p, end, "trailer"))
+		{	t.b = b;
+			t.size = end;
+			t.p = pdf_ws( b, p + 7, end);
+			t.e = pdf_value( b, t.p, end);
+			pdf->rootobj = 0;
+			if (pdf_trailer( job, &t) < 0)
+				return -2;
+		}
+	}
+
+	/* the objects in object streams; an xref stream is a trailer too */
+	for (num = 1; num < pdf->nobj; num++)
+	{	if (pdf->xref[num].type != 'n' ||
+		    pdf_object( pdf, b, end, num, &v) < 0 ||
+		    pdf_lookup( pdf, b, end, &v, "/Type", &t) < 0)
+			continue;
+		if (pdf_is( t.b, t.p, t.e, "/ObjStm"))
+			pdf_objstm( job, num, 1);
+		else if (pdf_is( t.b, t.p, t.e, "/XRef") && pdf_trailer( job, &v) < 0)
+			return -2;
+	}
+	/* no trailer said where the catalog is: look for it */
+	for (num = 1; num < pdf->nobj && !pdf->rootobj; num++)
+		if (pdf_object( pdf, b, end, num, &v) == 0 &&
+		    pdf_lookup( pdf, b, end, &v, "/Type", &t) == 0 &&
+		    pdf_is( t.b, t.p, t.e, "/Catalog"))
+			pdf->rootobj = num;
+	return 0;
+}
+
+/* decode object stream stm; with enter, note the objects in it */
+static int pdf_objstm( struct poster_job *job, long stm, int enter)
+{
+	struct poster_pdf *pdf = job->pdf;
+	struct pdfval v;
+	size_t p = 0;
+	long n, i, num, off;
+
+	if (stm <= 0 || stm >= pdf->nobj || pdf->xref[stm].type != 'n')
+		return -1;
+	if (!pdf->stmdata)
+	{	pdf->stmdata = calloc( pdf->nobj, sizeof( char *));
+		pdf->stmlen = calloc( pdf->nobj, sizeof( size_t));
+		if (!pdf->stmdata || !pdf->stmlen)
+			return -1;
+	}
+	if (!pdf->stmdata[stm] &&
+	    (pdf_object( pdf, job->inbuf, job->insize, stm, &v) < 0 ||
+	     pdf_decode( pdf, job->inbuf, job->insize, &v,
+			 &pdf->stmdata[stm], &pdf->stmlen[stm]) < 0))
+		return -1;
+	if (enter && pdf_object( pdf, job->inbuf, job->insize, stm, &v) == 0 &&
+	    pdf_getnum( pdf, job->inbuf, job->insize, &v, "/N", &n) == 0)
+		for (i = 0; i < n; i++)
+		{	if (pdf_num( pdf->stmdata[stm], &p, pdf->stmlen[stm], &num) < 0 ||
+			    pdf_num( pdf->stmdata[stm], &p, pdf->stmlen[stm], &off) < 0 ||
+			    num >= pdf->nobj)
+				break;
+			if (!pdf->xref[num].type)
+				pdf_setxref( pdf, num, 'c', 0, stm, i);
+		}
+	return 0;
+}
+
+/* a box [llx lly urx ury], in the right order */
+static int pdf_box( struct poster_pdf *pdf, const char *inbuf, size_t insize,
+		    struct pdfval *arr, double box[4])
+{
+	struct pdfval e;
+	size_t pos = 0;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (pdf_next( arr, &pos, &e) < 0 ||
+		    pdf_resolve( pdf, inbuf, insize, &e) < 0 || pdf_real( &e, box+i) < 0)
+			return -1;
+	if (box[0] > box[2]) exch( box[0], box[2]);
+	if (box[1] > box[3]) exch( box[1], box[3]);
+	return 0;
+}
+
+/* collect the pages below node, with what they inherit from above */
+static int pdf_pagetree( struct poster_job *job, long num, struct pdfpage *inherit,
+			 int depth)
+{
+	struct poster_pdf *pdf = job->pdf;
+	const char *b = job->inbuf;
+	size_t end = job->insize, pos = 0, q;
+	struct pdfval node, v, kid;
+	struct pdfpage page, *pg;
+	long kidnum;
+	double x;
+
+	if (depth > PdfMaxDepth || pdf_object( pdf, b, end, num, &node) < 0)
+		return fail( job, "Broken page tree in PDF '%s'!", job->inname);
+	page = *inherit;
+	if (pdf_lookup( pdf, b, end, &node, "/Resources", &v) == 0)
+	{	page.res = v;
+		page.gotres = 1;
+	}
+	if (pdf_lookup( pdf, b, end, &node, "/CropBox", &v) == 0 ||
+	    pdf_lookup( pdf, b, end, &node, "/MediaBox", &v) == 0)
+		pdf_box( pdf, b, end, &v, page.box);
+	if (pdf_lookup( pdf, b, end, &node, "/Rotate", &v) == 0 &&
+	    pdf_real( &v, &x) == 0)
+		page.rotate = ((int)floor( x / 90 + 0.5) % 4 + 4) % 4 * 90;
+
+	if (pdf_lookup( pdf, b, end, &node, "/Kids", &v) < 0)
+	{	/* a page */
+		if (pdf->npages == pdf->maxpages)
+		{	pdf->maxpages = 2 * pdf->maxpages + 16;
+			if (!(pg = realloc( pdf->pages, pdf->maxpages * sizeof( *pg))))
+				return fail( job, "Out of memory!");
+			pdf->pages = pg;
+		}
+		page.obj = num;
+		page.gotcontents = pdf_lookup( pdf, b, end, &node, "/Contents",
+					       &page.contents) == 0;
+		pdf->pages[ pdf->npages++] = page;
+		return 0;
+	}
+	while (pdf_next( &v, &pos, &kid) == 0)
+		if (!pdf_isref( kid.b, kid.p, kid.e, &kidnum, &q) ||
+		    pdf_pagetree( job, kidnum, &page, depth + 1) < 0)
+			return fail( job, "Broken page tree in PDF '%s'!", job->inname);
+	return 0;
+}
+
+/* the box of page pg as it shows, after its /Rotate, */
+/* and the matrix that turns it so */
+static void pdf_pagebox( struct pdfpage *pg, double bb[4], double m[6])
+{
+	double *b = pg->box;
+	static double rot[4][4] = {
+		{ 1, 0, 0, 1}, { 0, -1, 1, 0}, { -1, 0, 0, -1}, { 0, 1, -1, 0}};
+	double *r = rot[ pg->rotate / 90];
+	double x0, y0, x1, y1;
+
+	m[0] = r[0]; m[1] = r[1]; m[2] = r[2]; m[3] = r[3]; m[4] = m[5] = 0;
+	x0 = m[0] * b[0] + m[2] * b[1];
+	y0 = m[1] * b[0] + m[3] * b[1];
+	x1 = m[0] * b[2] + m[2] * b[3];
+	y1 = m[1] * b[2] + m[3] * b[3];
+	bb[0] = x0 < x1 ? x0 : x1;
+	bb[1] = y0 < y1 ? y0 : y1;
+	bb[2] = x0 < x1 ? x1 : x0;
+	bb[3] = y0 < y1 ? y1 : y0;
+}
+
+/* is the input a PDF file? */
+static int pdf_input( struct poster_job *job)
+{
+	size_t n = job->insize < 1024 ? job->insize : 1024, p;
+
+	for (p = 0; p + 5 <= n; p++)
+		if (job->inbuf[p] == '%' && !memcmp( job->inbuf + p, "%PDF-", 5))
+			return 1;
+	return 0;
+}
+
+/* the object streams, decoded once for all output, and the catalog */
+static int pdf_catalog( struct poster_job *job, struct pdfval *root)
+{
+	struct poster_pdf *pdf = job->pdf;
+	struct pdfval v;
+	long num;
+
+	for (num = 1; num < pdf->nobj; num++)
+		if (pdf->xref[num].type == 'c' &&
+		    pdf_objstm( job, pdf->xref[num].stm, 0) < 0)
+			pdf->xref[num].type = 'f';
+	if (pdf_object( pdf, job->inbuf, job->insize, pdf->rootobj, root) < 0)
+		return -1;
+	return pdf_lookup( pdf, job->inbuf, job->insize, root, "/Pages", &v);
+}
+
+/* read the structure of a PDF input: its objects and pages */
+static int pdf_read( struct poster_job *job)
+{
+	struct poster_pdf *pdf;
+	struct pdfpage top, *pg;
+	struct pdfval root, v, e;
+	const char *b = job->inbuf;
+	size_t end = job->insize, pos;
+	long num;
+	int i, r;
+
+	if (!(pdf = job->pdf = calloc( 1, sizeof( *pdf))))
+		return fail( job, "Out of memory!");
+	for (pos = 0; pos + 8 <= end && pos < 1024; pos++)
+		if (!memcmp( b + pos, "%PDF-", 5))
+			break;
+	memcpy( pdf->version, pos + 8 <= end && isdigit( (unsigned char)b[pos+5]) &&
+		b[pos+6] == '.' && isdigit( (unsigned char)b[pos+7]) ?
+		b + pos + 5 : "1.4", 3);
+
+	/* a damaged xref is rebuilt from the objects themselves */
+	if ((r = pdf_xref( job)) == -2)
+		return -1;
+	if (r < 0 || pdf_catalog( job, &root) < 0)
+	{	if ((r = pdf_rebuild( job)) == -2)
+			return -1;
+		if (r < 0 || pdf_catalog( job, &root) < 0)
+			return fail( job, "Cannot read PDF '%s'!", job->inname);
+	}
+
+	memset( &top, 0, sizeof( top));
+	top.box[2] = 612;	/* Letter, when no page says otherwise */
+	top.box[3] = 792;
+	if (pdf_get( &root, "/Pages", &v) < 0 ||
+	    !pdf_isref( v.b, v.p, v.e, &num, &pos) ||
+	    pdf_pagetree( job, num, &top, 0) < 0)
+		return -1;
+	if (pdf->npages <= 0)
+		return fail( job, "No pages in PDF '%s'!", job->inname);
+
+	/* pages with several content streams get them joined: */
+	/* check now that they can be */
+	for (pg = pdf->pages, i = 0; i < pdf->npages; i++, pg++)
+	{	if (!pg->gotcontents || pg->contents.b[pg->contents.p] != '[')
+			continue;
+		for (pos = 0; pdf_next( &pg->contents, &pos, &e) == 0;)
+			if (pdf_resolve( pdf, b, end, &e) < 0 ||
+			    pdf_decode( pdf, b, end, &e, NULL, NULL) < 0)
+				return fail( job, "Cannot join the contents of page %d of PDF '%s'!",
+					i+1, job->inname);
+	}
+
+	/* the layout goes by the pages as they show */
+	job->maxpages = job->npages = pdf->npages;
+	if (!(job->pages = calloc( (size_t)pdf->npages, sizeof( struct poster_page))))
+		return fail( job, "Out of memory!");
+	for (i = 0; i < pdf->npages; i++)
+	{	double m[6];
+
+		pdf_pagebox( pdf->pages + i, job->pages[i].bb, m);
+		job->pages[i].got_bb = 1;
+	}
+	job->got_bb = 1;
+	memcpy( job->ps_bb, job->pages[0].bb, sizeof( job->ps_bb));
+	note( job, 1, "PDF %s with %d page%s\n", job->inname, pdf->npages,
+		pdf->npages==1?"":"s");
+	if (pdf->npages > 1 && !job->pagemode)
+		note( job, 0, "Tiling page 1 of %d of '%s', use -P for all\n",
+			pdf->npages, job->inname);
+	return 0;
+}
+
+static void pdf_free( struct poster_pdf *pdf)
+{
+	int i;
+
+	if (!pdf)
+		return;
+	if (pdf->stmdata)
+		for (i = 0; i < pdf->nobj; i++)
+			free( pdf->stmdata[i]);
+	free( pdf->stmdata);
+	free( pdf->stmlen);
+	free( pdf->xref);
+	free( pdf->pages);
+	free( pdf);
+}
+
+/* a new output object */
+static int pdf_newobj( struct pdfout *po)
+{
+	size_t *o;
+
+	if (po->nout == po->maxout)
+	{	po->maxout = 2 * po->maxout + 64;
+		if (!(o = realloc( po->offs, po->maxout * sizeof( *o))))
+			return -1;
+		po->offs = o;
+	}
+	po->offs[ po->nout] = 0;
+	return po->nout++;
+}
+
+/* start writing output object n */
+static void pdf_begin( struct out *out, struct pdfout *po, int n)
+{
+	po->offs[n] = out->done + out->len;
+	oprintf( out, "%d 0 obj\n", n);
+}
+
+/* the output number of input object num: it is copied later */
+static int pdf_renum( struct poster_job *job, struct pdfout *po, long num)
+{
+	struct poster_pdf *pdf = po->pdf;
+	struct pdfval v, t;
+	int n;
+
+	if (num <= 0 || num >= pdf->nobj)
+		return -1;
+	if (po->renum[num])
+		return po->renum[num];
+	/* (no other pages along, from annotations and such) */
+	if (pdf_object( pdf, job->inbuf, job->insize, num, &v) < 0 ||
+	    (pdf_lookup( pdf, job->inbuf, job->insize, &v, "/Type", &t) == 0 &&
+	     (pdf_is( t.b, t.p, t.e, "/Page") || pdf_is( t.b, t.p, t.e, "/Pages"))) ||
+	    (n = pdf_newobj( po)) < 0)
+		return po->renum[num] = -1;
+	po->queue[ po->nqueue++] = num;
+	return po->renum[num] = n;
+}
+
+/* copy value v, with the references renumbered */
+static void pdf_copy( struct poster_job *job, struct out *out, struct pdfout *po,
+		      struct pdfval *v)
+{
+	size_t p = v->p, q;
+	long num;
+	int n;
+
+	while (p < v->e)
+	{	q = pdf_ws( v->b, p, v->e);
+		owrite( out, v->b + p, q - p);
+		if ((p = q) >= v->e)
+			break;
+		if (isdigit( (unsigned char)v->b[p]) &&
+		    pdf_isref( v->b, p, v->e, &num, &q))
+		{	if ((n = pdf_renum( job, po, num)) < 0)
+				oprintf( out, "null");
+			else	oprintf( out, "%d 0 R", n);
+		} else
+		{	q = pdf_token( v->b, p, v->e);
+			owrite( out, v->b + p, q - p);
+		}
+		p = q;
+	}
+}
+
+/* copy stream dictionary v, with its /Length being length */
+static void pdf_copydict( struct poster_job *job, struct out *out, struct pdfout *po,
+			  struct pdfval *v, size_t length)
+{
+	struct pdfval val;
+	size_t p, k;
+
+	oprintf( out, "<<");
+	for (p = v->p + 2;; p = val.e)
+	{	p = pdf_ws( v->b, p, v->e);
+		if (p >= v->e || v->b[p] != '/')
+			break;
+		k = pdf_token( v->b, p, v->e);
+		val = *v;
+		val.p = pdf_ws( v->b, k, v->e);
+		val.e = pdf_value( v->b, val.p, v->e);
+		if (pdf_is( v->b, p, k, "/Length"))
+			continue;
+		owrite( out, " ", 1);
+		owrite( out, v->b + p, k - p);
+		owrite( out, " ", 1);
+		pdf_copy( job, out, po, &val);
+	}
+	oprintf( out, " /Length %lu >>\n", (unsigned long)length);
+}
+
+/* copy the input objects that were referred to, until there are none left */
+static void pdf_flush( struct poster_job *job, struct out *out, struct pdfout *po)
+{
+	struct pdfval v;
+	const char *data;
+	size_t len;
+	long num;
+
+	while (po->nqueue > 0)
+	{	num = po->queue[ --po->nqueue];
+		pdf_begin( out, po, po->renum[num]);
+		if (pdf_object( po->pdf, job->inbuf, job->insize, num, &v) < 0)
+			oprintf( out, "null");
+		else if (pdf_stream( po->pdf, job->inbuf, job->insize, &v, &data, &len) == 0)
+		{	pdf_copydict( job, out, po, &v, len);
+			oprintf( out, "stream\n");
+			owrite( out, data, len);
+			oprintf( out, "\nendstream");
+		} else	pdf_copy( job, out, po, &v);
+		oprintf( out, "\nendobj\n");
+	}
+}
+
+/* page pg of the input, as form XObject n */
+static int pdf_form( struct poster_job *job, struct out *out, struct pdfout *po,
+		     struct pdfpage *pg, int n)
+{
+	struct poster_pdf *pdf = po->pdf;
+	struct pdfval v, e;
+	const char *data = "";
+	char *joined = NULL, *d, *z = NULL;
+	size_t len = 0, l, pos = 0;
+	uLongf zlen;
+	double bb[4], m[6];
+	int single;
+
+	pdf_pagebox( pg, bb, m);
+	pdf_begin( out, po, n);
+	oprintf( out, "<< /Type /XObject /Subtype /Form /FormType 1\n"
+		"/BBox [%g %g %g %g] /Matrix [%g %g %g %g %g %g]\n/Resources ",
+		pg->box[0], pg->box[1], pg->box[2], pg->box[3],
+		m[0], m[1], m[2], m[3], m[4], m[5]);
+	if (pg->gotres)
+		pdf_copy( job, out, po, &pg->res);
+	else	oprintf( out, "<< >>");
+	oprintf( out, "\n");
+
+	v = pg->contents;
+	single = pg->gotcontents && v.b[v.p] != '[';
+	if (single && pdf_stream( pdf, job->inbuf, job->insize, &v, &data, &len) == 0)
+	{	/* its content stream as it is */
+		if (pdf_get( &v, "/Filter", &e) == 0)
+		{	oprintf( out, "/Filter ");
+			pdf_copy( job, out, po, &e);
+		}
+		if (pdf_get( &v, "/DecodeParms", &e) == 0)
+		{	oprintf( out, " /DecodeParms ");
+			pdf_copy( job, out, po, &e);
+		}
+	} else if (pg->gotcontents && !single)
+	{	/* several streams, that may split an operator: */
+		/* inflate them and make them one */
+		while (pdf_next( &pg->contents, &pos, &e) == 0)
+		{	if (pdf_resolve( pdf, job->inbuf, job->insize, &e) < 0 ||
+			    pdf_decode( pdf, job->inbuf, job->insize, &e, &d, &l) < 0)
+			{	free( joined);
+				return fail( job, "Cannot join the contents of PDF '%s'!",
+					job->inname);
+			}
+			if (!(joined = realloc( joined, len + l + 1)))
+			{	free( d);
+				return fail( job, "Out of memory!");
+			}
+			memcpy( joined + len, d, l);
+			joined[ len + l] = '\n';
+			len += l + 1;
+			free( d);
+		}
+		zlen = compressBound( len);
+		if (!(z = malloc( zlen)) ||
+		    compress2( (Bytef *)z, &zlen, (Bytef *)joined, len, 6) != Z_OK)
+		{	free( joined);
+			free( z);
+			return fail( job, "Out of memory!");
+		}
+		free( joined);
+		data = z;
+		len = zlen;
+		oprintf( out, "/Filter /FlateDecode");
+	}
+	oprintf( out, " /Length %lu >>\nstream\n", (unsigned long)len);
+	owrite( out, data, len);
+	oprintf( out, "\nendstream\nendobj\n");
+	free( z);
+
+	pdf_flush( job, out, po);
+	return 0;
+}
+
+/* one tile: a sheet that draws form n, */
+/* as tileprolog ... tileepilog would */
+static int pdf_tile( struct poster_job *job, struct out *out, struct pdfout *po,
+		     int form, double scale, double *imagebb, double *posterbb,
+		     int rotate, int row, int col, int page)
+{
+	char buf[2*BUFSIZE], *cut;
+	int lm = job->sheetmargin[0], bm = job->sheetmargin[1];
+	int pw = job->sheetsize[2] - 2.0*job->sheetmargin[0];
+	int ph = job->sheetsize[3] - 2.0*job->sheetmargin[1];
+	int c = 6, rowcount = rotate ? col : row, colcount = rotate ? row : col;
+	double tx = -pw * (colcount - 1), ty = -ph * (rowcount - 1);
+	int contents, n, len, seams[2];
+
+	note( job, 1, "print page %d\n", page);
+
+	/* clip, then the page contents transformation */
+	len = snprintf( buf, sizeof( buf),
+		"q\n1 0 0 1 %d %d cm\n%d %d %d %d re W n\n",
+		lm, bm, -c, -c, pw + 2*c, ph + 2*c);
+	if (rotate)
+		len += snprintf( buf + len, sizeof( buf) - len,
+			"0 1 -1 0 %d 0 cm\n", pw);
+	len += snprintf( buf + len, sizeof( buf) - len,
+		"1 0 0 1 %.4f %.4f cm\n1 0 0 1 %.4f %.4f cm\n%.10f 0 0 %.10f 0 0 cm\n"
+		"1 0 0 1 %.4f %.4f cm\n"
+		"0 g 0 G 0 J 1 w 0 j 10 M [] 0 d\n/P Do\nQ\n",
+		(rotate ? ty : tx) + 0.0, (rotate ? tx : ty) + 0.0,
+		posterbb[0], posterbb[1], scale, scale,
+		0.0 - imagebb[0], 0.0 - imagebb[1]);
+
+	/* the cutmarks, and the label */
+	cut = "6 0 m %d 0 l S 6 -6 m 12 -6 l 6 6 l 12 6 l h f\n";
+	if (job->rollspec)
+	{	/* on a roll: cut lines along the seams only */
+		rollseams( job, seams);
+		len += snprintf( buf + len, sizeof( buf) - len,
+			"q\n1 0 0 1 %d %d cm 0.23 w 0 G\n", lm, bm);
+		if (seams[0])
+			len += snprintf( buf + len, sizeof( buf) - len,
+				"0 0 m 0 %d l S %d 0 m %d %d l S\n", ph, pw, pw, ph);
+		if (seams[1])
+			len += snprintf( buf + len, sizeof( buf) - len,
+				"0 0 m %d 0 l S 0 %d m %d %d l S\n", pw, ph, pw, ph);
+	} else
+		len += snprintf( buf + len, sizeof( buf) - len,
+			"q\n1 0 0 1 %d %d cm 0.23 w 0 g 0 G\n1 0 0 1 %d %d cm\n",
+			lm, bm, pw, ph);
+	for (n = job->rollspec ? 4 : 0; n < 4; n++)
+	{	if (n > 0)
+			len += snprintf( buf + len, sizeof( buf) - len,
+				"1 0 0 1 0 %d cm\n", n % 2 ? pw : ph);
+		len += snprintf( buf + len, sizeof( buf) - len, cut, lm);
+		len += snprintf( buf + len, sizeof( buf) - len, "0 1 -1 0 0 0 cm\n");
+		len += snprintf( buf + len, sizeof( buf) - len, cut, lm);
+	}
+	len += snprintf( buf + len, sizeof( buf) - len,
+		"Q\nBT /F 9 Tf %d %d Td (Grid \\( %d , %d \\)) Tj ET\n",
+		lm + 3*c, bm - c - 9, rowcount, colcount);
+
+	if ((contents = pdf_newobj( po)) < 0 || (n = pdf_newobj( po)) < 0)
+		return fail( job, "Out of memory!");
+	pdf_begin( out, po, contents);
+	oprintf( out, "<< /Length %d >>\nstream\n", len);
+	owrite( out, buf, len);
+	oprintf( out, "\nendstream\nendobj\n");
+	pdf_begin( out, po, n);
+	oprintf( out, "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 %d %d]\n"
+		"/Resources << /XObject << /P %d 0 R >> /Font << /F 3 0 R >> >>\n"
+		"/Contents %d 0 R >>\nendobj\n",
+		(int)job->sheetsize[2], (int)job->sheetsize[3], form, contents);
+	return n;
+}
+
+/* write a PDF document with npages tiles, from tile first on */
+static int pdf_output( struct poster_job *job, struct out *out, int first, int npages)
+{
+	struct poster_pdf *pdf = job->pdf;
+	struct pdfout po;
+	struct poster_page *pg = NULL;
+	int *forms, *kids, i, t, p, n, r = 0;
+	size_t xref, at;
+	char *c;
+
+	memset( &po, 0, sizeof( po));
+	po.pdf = pdf;
+	po.renum = calloc( pdf->nobj, sizeof( int));
+	po.queue = malloc( pdf->nobj * sizeof( int));
+	forms = calloc( pdf->npages, sizeof( int));
+	kids = malloc( (npages + 1) * sizeof( int));
+	if (!po.renum || !po.queue || !forms || !kids)
+		r = fail( job, "Out of memory!");
+	/* 1: catalog, 2: page tree, 3: font of the labels, 4: info */
+	for (i = 0; i < 5 && r == 0; i++)
+		if (pdf_newobj( &po) < 0)
+			r = fail( job, "Out of memory!");
+	if (job->manualfeed)
+		note( job, 1, "Manual feed is not asked for in PDF output\n");
+
+	oprintf( out, "%%PDF-%.3s\n%%\342\343\317\323\n", pdf->version);
+	if (r == 0)
+	{	pdf_begin( out, &po, 1);
+		oprintf( out, "<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+		pdf_begin( out, &po, 3);
+		oprintf( out, "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica\n"
+			"/Encoding /WinAnsiEncoding >>\nendobj\n");
+		pdf_begin( out, &po, 4);
+		oprintf( out, "<< /Creator (");
+		for (c = job->creator; *c; c++)
+			oprintf( out, strchr( "()\\", *c) ? "\\%c" : "%c", *c);
+		oprintf( out, ") >>\nendobj\n");
+	}
+
+	out->tilestart = now();
+	for (i = first; i < first + npages && r == 0; i++)
+	{	t = tilenumber( job, i);
+		at = out->done + out->len;
+		p = paging( job) ? (pg = tilepage( job, i)) - job->pages : 0;
+		if (!forms[p] &&
+		    ((forms[p] = pdf_newobj( &po)) < 0 ||
+		     pdf_form( job, out, &po, pdf->pages + p, forms[p]) < 0))
+		{	r = forms[p] < 0 ? fail( job, "Out of memory!") : -1;
+			break;
+		}
+		if (pg)
+			n = pdf_tile( job, out, &po, forms[p], pg->scale,
+				pg->imagebb, pg->posterbb, pg->rotate,
+				t/pg->ncols + 1, t%pg->ncols + 1, t+1);
+		else
+			n = pdf_tile( job, out, &po, forms[p], job->scale,
+				job->imagebb, job->posterbb, job->rotate,
+				t/job->ncols + 1, t%job->ncols + 1, t+1);
+		if ((kids[i - first] = n) < 0)
+			r = -1;
+		tiledone( out, i, at);
+	}
+
+	if (r == 0)
+	{	pdf_begin( out, &po, 2);
+		oprintf( out, "<< /Type /Pages /Count %d /Kids [", npages);
+		for (i = 0; i < npages; i++)
+			oprintf( out, "%s%d 0 R", i % 8 ? " " : "\n", kids[i]);
+		oprintf( out, "\n] >>\nendobj\n");
+
+		xref = out->done + out->len;
+		oprintf( out, "xref\n0 %d\n0000000000 65535 f \n", po.nout);
+		for (i = 1; i < po.nout; i++)
+			oprintf( out, "%010lu 00000 n \n", (unsigned long)po.offs[i]);
+		oprintf( out, "trailer\n<< /Size %d /Root 1 0 R /Info 4 0 R >>\n"
+			"startxref\n%lu\n%%%%EOF\n", po.nout, (unsigned long)xref);
+	}
+	free( po.renum);
+	free( po.queue);
+	free( po.offs);
+	free( forms);
+	free( kids);
+	return r;
+}
+
+/*********************************************/
+/* output the poster as several documents,   */
+/* with tiles balanced over the files by size */
+/*********************************************/
+struct split {
+	struct poster_job *job;
+	char *pattern;
+	int ngroups;
+	int *groupfirst;	/* first tile of each group, [ngroups] is the end */
+	int nextgroup;		/* next group for a worker to pick up */
+	int err;
+	pthread_mutex_t lock;
+};
+
+int poster_split( struct poster_job *job, char *pattern,
+		  int ngroups, int nthreads)
+{
+	struct split split;
+	pthread_t *threads;
+	long total, sum, size;
+	int i, g, ntiles, *groupfirst;
+
+	if (poster_checkpattern( job, pattern) < 0)
+		return -1;
+
+	ntiles = job->ntiles;
+	if (ngroups <= 0 || ngroups > ntiles)
+		ngroups = ntiles;
+	if (nthreads <= 0)
+		nthreads = sysconf( _SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > ngroups)
+		nthreads = ngroups;
+
+	/* consecutive tiles per group, so that each printer */
+	/* outputs neighbouring sheets: split at equal byte counts */
+	groupfirst = malloc( (ngroups+1) * sizeof( int));
+	threads = malloc( nthreads * sizeof( pthread_t));
+	if (!groupfirst || !threads)
+	{	free( groupfirst);
+		free( threads);
+		return fail( job, "Out of memory!");
+	}
+	for (total = i = 0; i < ntiles; i++)
+		total += tilebytes( job, i);
+	for (g = 0; g <= ngroups; g++)
+		groupfirst[g] = ntiles;
+	if (ngroups == ntiles)
+		for (g = 0; g < ngroups; g++)
+			groupfirst[g] = g;
+	else
+	{	for (sum = i = 0, g = -1; i < ntiles; i++)
+		{	/* the middle of a tile decides its group */
+			size = tilebytes( job, i);
+			for (; g < ngroups-1 &&
+			       (g < 0 || (double)(sum + size/2) * ngroups >= (double)(g+1) * total);
+			     g++)
+				groupfirst[g+1] = i;
+			sum += size;
+		}
+		/* no group may be empty: a large tile may have put several */
+		/* split points on it, so move each past the one before, */
+		/* then pull back tiles from the end; now g <= groupfirst[g] */
+		/* <= ntiles-ngroups+g */
+		for (g = 1; g < ngroups; g++)
+			if (groupfirst[g] <= groupfirst[g-1])
+				groupfirst[g] = groupfirst[g-1] + 1;
+		for (g = ngroups-1; g > 0; g--)
+			if (groupfirst[g] >= groupfirst[g+1])
+				groupfirst[g] = groupfirst[g+1] - 1;
+	}
+
+	note( job, 1, "Writing %d tile%s to %d file%s with %d thread%s\n",
+		ntiles, ntiles==1?"":"s", ngroups, ngroups==1?"":"s",
+		nthreads, nthreads==1?"":"s");
+
+	split.job = job;
+	split.pattern = pattern;
+	split.ngroups = ngroups;
+	split.groupfirst = groupfirst;
+	split.nextgroup = 0;
+	split.err = 0;
+	pthread_mutex_init( &split.lock, NULL);
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create( &threads[i], NULL, splitworker, &split))
+		{	pthread_mutex_lock( &split.lock);
+			if (!split.err)
+				fail( job, "cannot create thread!");
+			split.err = 1;
+			pthread_mutex_unlock( &split.lock);
+			break;
+		}
+	while (--i >= 0)
+		pthread_join( threads[i], NULL);
+	pthread_mutex_destroy( &split.lock);
+	free( threads);
+	free( groupfirst);
+	return split.err ? -1 : 0;
+}
+
+/* write group after group, until none is left */
+static void *splitworker( void *arg)
+{
+	struct split *split = arg;
+	struct poster_job *job = split->job;
+	struct poster_sink sink;
+	struct poster_stats st;
+	char name[BUFSIZE];
+	int g, *first = split->groupfirst, r, fd, n;
+
+	for (;;)
+	{	pthread_mutex_lock( &split->lock);
+		g = split->err ? split->ngroups : split->nextgroup++;
+		pthread_mutex_unlock( &split->lock);
+		if (g >= split->ngroups) break;
+
+		/* one file per tile: name it after the tile */
+		snprintf( name, BUFSIZE, split->pattern,
+			split->ngroups == job->ntiles && !paging( job) ?
+			tilenumber( job, g)+1 : g+1);
+		n = first[g+1] - first[g];
+		if ((fd = outfile( job, name, poster_outsize( job, first[g], n))) < 0)
+		{	pthread_mutex_lock( &split->lock);
+			if (!split->err)
+				fail( job, "Cannot open '%s' for writing!", name);
+			split->err = 1;
+			pthread_mutex_unlock( &split->lock);
+			break;
+		}
+		if (paging( job))
+			note( job, 1, "Writing pages %d-%d to '%s'\n",
+				first[g]+1, first[g+1], name);
+		else
+			note( job, 1, "Writing tiles %d-%d to '%s'\n",
+				tilenumber( job, first[g])+1,
+				tilenumber( job, first[g+1]-1)+1, name);
+
+		poster_fd_sink( &sink, fd);
+		memset( &st, 0, sizeof( st));
+		r = output( job, &sink, first[g], n, &st);
+		pthread_mutex_lock( &split->lock);
+		addstats( &job->stats, &st);
+		pthread_mutex_unlock( &split->lock);
+		if (closeout( fd) < 0 || r < 0)
+		{	pthread_mutex_lock( &split->lock);
+			if (!split->err)
+				fail( job, "write error on '%s'!", name);
+			split->err = 1;
+			pthread_mutex_unlock( &split->lock);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* add the output figures of st to those of to */
+static void addstats( struct poster_stats *to, struct poster_stats *st)
+{
+	to->prologtime += st->prologtime;
+	to->tiletime += st->tiletime;
+	to->outbytes += st->outbytes;
+	to->sinkbytes += st->sinkbytes;
+}
+
+/*********************************************/
+/* many input files with the same settings:  */
+/* media and margins are decided only once   */
+/*********************************************/
+struct batch {
+	struct poster_job *job;	/* template, after poster_media() */
+	char **files;
+	int nfiles;
+	char *pattern;
+	struct poster_result *results;
+	int next;		/* next file for a worker to pick up */
+	int nfailed;
+	pthread_mutex_t lock;
+};
+
+int poster_batch( struct poster_job *job, char **files, int nfiles,
+		  char *pattern, int nthreads, struct poster_result *results)
+{
+	struct batch batch;
+	pthread_t *threads;
+	char name[POSTER_MSGSIZE];
+	int i;
+
+	/* a bad pattern would fail every file: refuse it right away */
+	if (nfiles > 0 &&
+	    poster_batchname( job, pattern, files[0], name, sizeof( name)) < 0)
+		return -1;
+
+	if (nthreads <= 0)
+		nthreads = sysconf( _SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > nfiles)
+		nthreads = nfiles;
+	if (!(threads = malloc( (nthreads+1) * sizeof( pthread_t))))
+		return fail( job, "Out of memory!");
+
+	note( job, 1, "Converting %d file%s with %d thread%s\n",
+		nfiles, nfiles==1?"":"s", nthreads, nthreads==1?"":"s");
+
+	batch.job = job;
+	batch.files = files;
+	batch.nfiles = nfiles;
+	batch.pattern = pattern;
+	batch.results = results;
+	batch.next = 0;
+	batch.nfailed = 0;
+	pthread_mutex_init( &batch.lock, NULL);
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create( &threads[i], NULL, batchworker, &batch))
+			break;
+	if (i == 0)	/* no threads at all: do it myself */
+		batchworker( &batch);
+	while (--i >= 0)
+		pthread_join( threads[i], NULL);
+	pthread_mutex_destroy( &batch.lock);
+	free( threads);
+	return batch.nfailed;
+}
+
+/* convert file after file, until none is left */
+static void *batchworker( void *arg)
+{
+	struct batch *batch = arg;
+	struct poster_result *res;
+	struct poster_job job;
+	struct poster_sink sink;
+	int i, r, fd;
+
+	for (;;)
+	{	pthread_mutex_lock( &batch->lock);
+		i = batch->next++;
+		pthread_mutex_unlock( &batch->lock);
+		if (i >= batch->nfiles) break;
+
+		res = batch->results + i;
+		memset( res, 0, sizeof( *res));
+		res->infile = batch->files[i];
+		res->seconds = now();
+
+		/* settings and media from the template, a fresh input */
+		job = *batch->job;
+		job.infile = batch->files[i];
+		job.indata = NULL;
+		job.inbuf = NULL;
+		job.inmapped = 0;
+		job.spans = NULL;
+		job.nspans = job.maxspans = 0;
+		job.tail_cntl_D = 0;
+		job.dsclines = NULL;
+		job.dsclen = job.dscalloc = 0;
+		job.tiles = NULL;
+		job.ntiles = 0;
+		job.pages = NULL;
+		job.npages = job.maxpages = 0;
+		job.resources = NULL;
+		job.nresources = job.maxresources = 0;
+		job.pdf = NULL;
+		memset( &job.stats, 0, sizeof( job.stats));
+
+		r = poster_batchname( &job, batch->pattern, job.infile,
+				res->outfile, sizeof( res->outfile));
+		if (r == 0)
+			r = poster_read( &job);
+		if (r == 0 && job.pdf)
+			pdfname( res->outfile, sizeof( res->outfile));
+		if (r == 0)
+			r = poster_layout( &job);
+		if (r == 0)
+		{	if ((fd = outfile( &job, res->outfile,
+					   poster_outsize( &job, 0, job.ntiles))) < 0)
+				r = fail( &job, "Cannot open '%s' for writing!",
+					res->outfile);
+			else
+			{	poster_fd_sink( &sink, fd);
+				r = poster_output( &job, &sink, 0, job.ntiles);
+				res->bytes = job.stats.sinkbytes;
+				if (closeout( fd) < 0 && r == 0)
+					r = fail( &job, "write error on '%s'!",
+						res->outfile);
+				if (r < 0)
+					unlink( res->outfile);
+			}
+		}
+
+		res->status = r;
+		res->npages = job.ntiles;
+		res->seconds = now() - res->seconds;
+		if (r < 0)
+		{	strcpy( res->errmsg, job.errmsg);
+			pthread_mutex_lock( &batch->lock);
+			batch->nfailed++;
+			pthread_mutex_unlock( &batch->lock);
+		}
+		note( &job, 1, "Converted '%s' %s\n", job.infile,
+			r < 0 ? "with errors" : "fine");
+		poster_free( &job);
+	}
+	return NULL;
+}
+
+/* create output file name, with room for about size bytes */
+static int outfile( struct poster_job *job, char *name, long size)
+{
+	int fd = open( name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+	if (fd >= 0 && !job->gzlevel)
+		poster_reserve( fd, size);
+	return fd;
+}
+
+/* close it, without the room that was not used */
+static int closeout( int fd)
+{
+	int r = poster_trim( fd);
+
+	return close( fd) < 0 ? -1 : r;
+}
+
+/* PDF input gives PDF output: name.ps becomes name.pdf */
+static void pdfname( char *name, size_t size)
+{
+	size_t l = strlen( name);
+	char *ext = l > 3 && !strcmp( name + l - 3, ".ps") ? name + l - 3 :
+		    l > 6 && !strcmp( name + l - 6, ".ps.gz") ? name + l - 6 : NULL;
+
+	if (ext && l + 1 < size)
+	{	memmove( ext + 4, ext + 3, strlen( ext + 3) + 1);
+		memcpy( ext, ".pdf", 4);
+	}
+}
+
+/* replace %s in the pattern by the input name, */
+/* without directory and extension */
+int poster_batchname( struct poster_job *job, char *pattern, char *infile,
+		      char *name, size_t size)
+{
+	char *base, *dot, *c;
+	size_t n = 0, l;
+	int got = 0;
+
+	base = strrchr( infile, '/') ? strrchr( infile, '/') + 1 : infile;
+	l = (dot = strrchr( base, '.')) && dot != base ? dot - base : strlen( base);
+
+	for (c = pattern; *c; c++)
+	{	if (c[0] == '%' && c[1] == 's' && !got++)
+		{	if (n + l >= size) break;
+			memcpy( name + n, base, l);
+			n += l;
+			c++;
+			continue;
+		}
+		if (c[0] == '%' && c[1] == '%')
+			c++;
+		else if (c[0] == '%')
+			return fail( job, "Output pattern '%s' should contain one %%s!",
+				pattern);
+		if (n + 1 >= size) break;
+		name[n++] = *c;
+	}
+	if (*c)
+		return fail( job, "Output name for '%s' too long!", infile);
+	if (!got)
+		return fail( job, "Output pattern '%s' should contain one %%s!",
+			pattern);
+	name[n] = '\0';
+	return 0;
+}
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* the split file pattern should take exactly one integer */
+int poster_checkpattern( struct poster_job *job, char *pattern)
+{
+	char *c;
+	int n = 0;
+
+	for (c = pattern; *c; c++)
+	{	if (*c != '%') continue;
+		if (*++c == '%') continue;
+		while (*c && strchr( "-0+ #'", *c)) c++;
+		while (isdigit( *c)) c++;
+		if (*c != 'd' || n++)
+			return fail( job, "File pattern '%s' should contain one %%d!",
+				pattern);
+	}
+	if (!n)
+		return fail( job, "File pattern '%s' should contain one %%d!",
+			pattern);
+	return 0;
+}
+
+/*********************************************/
+/* buffered output to the sink               */
+/*********************************************/
+static void oprintf( struct out *out, char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start( ap, fmt);
+	n = vsnprintf( out->buf + out->len, OUTBUFSIZE - out->len, fmt, ap);
+	va_end( ap);
+	if (n >= 0 && out->len + n < OUTBUFSIZE)
+	{	out->len += n;
+		return;
+	}
+
+	/* did not fit: flush and retry */
+	oflush( out);
+	va_start( ap, fmt);
+	n = vsnprintf( out->buf, OUTBUFSIZE, fmt, ap);
+	va_end( ap);
+	if (n < 0 || n >= OUTBUFSIZE)
+		out->err = 1;
+	else	out->len = n;
+}
+
+static void owrite( struct out *out, const char *p, size_t n)
+{
+	if (out->len + n <= OUTBUFSIZE)
+	{	memcpy( out->buf + out->len, p, n);
+		out->len += n;
+		return;
+	}
+
+	oflush( out);
+	if (n >= OUTBUFSIZE/2)
+	{	/* large block: straight to the sink, no copy */
+		if (!out->err && out->sink->write( out->sink->handle, p, n) < 0)
+			out->err = 1;
+		out->done += n;
+	} else
+	{	memcpy( out->buf, p, n);
+		out->len = n;
+	}
+}
+
+static void oflush( struct out *out)
+{
+	if (out->len && !out->err &&
+	    out->sink->write( out->sink->handle, out->buf, out->len) < 0)
+		out->err = 1;
+	out->done += out->len;
+	out->len = 0;
+}
+
+static int sink_file( void *handle, const char *buf, size_t n)
+{
+	return fwrite( buf, 1, n, (FILE *)handle) == n ? 0 : -1;
+}
+
+static int sink_counted( void *handle, const char *buf, size_t n)
+{
+	struct counted *c = handle;
+
+	c->count += n;
+	return c->sink->write( c->sink->handle, buf, n);
+}
+
+static int sink_fd( void *handle, const char *buf, size_t n)
+{
+	int fd = (int)(long)handle;
+	ssize_t w;
+
+	while (n > 0)
+	{	if ((w = write( fd, buf, n)) < 0)
+		{	if (errno == EINTR) continue;
+			return -1;
+		}
+		buf += w;
+		n -= w;
+	}
+	return 0;
+}
+
+static int sink_socket( void *handle, const char *buf, size_t n)
+{
+	int fd = (int)(long)handle;
+	ssize_t w;
+
+	while (n > 0)
+	{	if ((w = send( fd, buf, n, MSG_NOSIGNAL)) < 0)
+		{	if (errno == EINTR) continue;
+			return -1;
+		}
+		buf += w;
+		n -= w;
+	}
+	return 0;
+}
+
+static int sink_memory( void *handle, const char *buf, size_t n)
+{
+	struct poster_memory *mem = handle;
+	size_t alloc;
+	char *p;
+
+	if (mem->len + n > mem->alloc)
+	{	alloc = 2*mem->alloc > mem->len + n ? 2*mem->alloc : mem->len + n;
+		if (!(p = realloc( mem->buf, alloc)))
+			return -1;
+		mem->buf = p;
+		mem->alloc = alloc;
+	}
+	memcpy( mem->buf + mem->len, buf, n);
+	mem->len += n;
+	return 0;
+}
+
+void poster_file_sink( struct poster_sink *sink, FILE *fp)
+{
+	sink->write = sink_file;
+	sink->handle = fp;
+}
+
+void poster_fd_sink( struct poster_sink *sink, int fd)
+{
+	sink->write = sink_fd;
+	sink->handle = (void *)(long)fd;
+}
+
+void poster_socket_sink( struct poster_sink *sink, int fd)
+{
+	sink->write = sink_socket;
+	sink->handle = (void *)(long)fd;
+}
+
+void poster_memory_sink( struct poster_sink *sink, struct poster_memory *mem)
+{
+	sink->write = sink_memory;
+	sink->handle = mem;
+}
+
+/* blocks for the output are claimed from the file system beforehand, */
+/* rather than a few at a time as the writes come in */
+void poster_reserve( int fd, long size)
+{
+	struct stat st;
+	off_t at;
+
+	if (size > 0 && fstat( fd, &st) == 0 && S_ISREG( st.st_mode) &&
+	    (at = lseek( fd, 0, SEEK_CUR)) >= 0)
+		posix_fallocate( fd, at, size);
+}
+
+int poster_trim( int fd)
+{
+	struct stat st;
+	off_t at;
+
+	if (fstat( fd, &st) < 0 || !S_ISREG( st.st_mode) ||
+	    (at = lseek( fd, 0, SEEK_CUR)) < 0 || at >= st.st_size)
+		return 0;
+	return ftruncate( fd, at);
+}
+
+/*********************************************/
+/* writer sink: the output goes to a thread  */
+/* in large buffers, such that a slow sink   */
+/* (NFS, a network) does not hold up making  */
+/* the output. Small output is written right */
+/* away on close, without a thread at all.   */
+/*********************************************/
+struct poster_writer {
+	struct poster_sink *to;
+	char *buf[2];
+	size_t len[2], size;
+	int fill;		/* the buffer being filled */
+	int busy;		/* the other one is being written */
+	int started, quit, err;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct poster_writer *poster_writer_open( struct poster_sink *sink,
+		struct poster_sink *to, size_t bufsize)
+{
+	struct poster_writer *w;
+	void *p;
+
+	if (!(w = calloc( 1, sizeof( *w))))
+		return NULL;
+	w->to = to;
+	w->size = (bufsize + PAGESIZE-1) / PAGESIZE * PAGESIZE;
+	if (w->size == 0) w->size = PAGESIZE;
+	if (posix_memalign( &p, PAGESIZE, w->size))
+	{	free( w);
+		return NULL;
+	}
+	w->buf[0] = p;
+	pthread_mutex_init( &w->lock, NULL);
+	pthread_cond_init( &w->cond, NULL);
+
+	sink->write = sink_writer;
+	sink->handle = w;
+	return w;
+}
+
+/* write the rest, wait for the thread, and free everything */
+int poster_writer_close( struct poster_writer *w)
+{
+	int err;
+
+	if (!w->started)
+	{	if (w->len[0] && !w->err &&
+		    w->to->write( w->to->handle, w->buf[0], w->len[0]) < 0)
+			w->err = 1;
+	} else
+	{	if (w->len[ w->fill])
+			writerswap( w);
+		pthread_mutex_lock( &w->lock);
+		while (w->busy)
+			pthread_cond_wait( &w->cond, &w->lock);
+		w->quit = 1;
+		pthread_cond_broadcast( &w->cond);
+		pthread_mutex_unlock( &w->lock);
+		pthread_join( w->thread, NULL);
+	}
+	pthread_mutex_destroy( &w->lock);
+	pthread_cond_destroy( &w->cond);
+	err = w->err;
+	free( w->buf[0]);
+	free( w->buf[1]);
+	free( w);
+	return err ? -1 : 0;
+}
+
+static int sink_writer( void *handle, const char *buf, size_t n)
+{
+	struct poster_writer *w = handle;
+	size_t l;
+
+	while (n > 0 && !writererr( w))
+	{	l = w->size - w->len[ w->fill];
+		if (l > n) l = n;
+		memcpy( w->buf[ w->fill] + w->len[ w->fill], buf, l);
+		w->len[ w->fill] += l;
+		buf += l;
+		n -= l;
+		if (w->len[ w->fill] == w->size)
+			writerswap( w);
+	}
+	return writererr( w) ? -1 : 0;
+}
+
+/* has the thread failed to write? */
+static int writererr( struct poster_writer *w)
+{
+	int err;
+
+	pthread_mutex_lock( &w->lock);
+	err = w->err;
+	pthread_mutex_unlock( &w->lock);
+	return err;
+}
+
+/* hand the full buffer to the thread, when it is done with the other */
+static void writerswap( struct poster_writer *w)
+{
+	void *p;
+
+	if (!w->started)
+	{	/* the output does not fit one buffer: now use two */
+		if (posix_memalign( &p, PAGESIZE, w->size))
+			p = NULL;
+		if (!(w->buf[1] = p) ||
+		    pthread_create( &w->thread, NULL, writerthread, w))
+		{	/* no thread then: write it here and now */
+			free( w->buf[1]);
+			w->buf[1] = NULL;
+			if (w->to->write( w->to->handle, w->buf[0], w->len[0]) < 0)
+				w->err = 1;
+			w->len[0] = 0;
+			return;
+		}
+		w->started = 1;
+	}
+	pthread_mutex_lock( &w->lock);
+	while (w->busy)
+		pthread_cond_wait( &w->cond, &w->lock);
+	w->busy = 1;
+	w->fill ^= 1;
+	w->len[ w->fill] = 0;
+	pthread_cond_broadcast( &w->cond);
+	pthread_mutex_unlock( &w->lock);
+}
+
+static void *writerthread( void *arg)
+{
+	struct poster_writer *w = arg;
+	int b, r;
+
+	pthread_mutex_lock( &w->lock);
+	for (;;)
+	{	while (!w->busy && !w->quit)
+			pthread_cond_wait( &w->cond, &w->lock);
+		if (!w->busy)
+			break;
+		b = w->fill ^ 1;
+		pthread_mutex_unlock( &w->lock);
+		r = w->err ? 0 : w->to->write( w->to->handle, w->buf[b], w->len[b]);
+		pthread_mutex_lock( &w->lock);
+		if (r < 0)
+			w->err = 1;
+		w->busy = 0;
+		pthread_cond_broadcast( &w->cond);
+	}
+	pthread_mutex_unlock( &w->lock);
+	return NULL;
+}
+
+/*********************************************/
+/* gzip sink: the output is cut in blocks,   */
+/* that threads compress each into a gzip    */
+/* member of its own (as pigz does). The     */
+/* members are written in order, which gives */
+/* a normal gzip stream. A ring of twice as  */
+/* many blocks as threads bounds the memory. */
+/*********************************************/
+#define GzBlockSize (128 * 1024)
+
+struct gzblock {
+	char *in, *out;
+	size_t inlen, outlen, outsize;
+	int state;		/* GzFree, GzFull, GzBusy or GzDone */
+};
+#define GzFree	0
+#define GzFull	1
+#define GzBusy	2
+#define GzDone	3
+
+struct poster_gzip {
+	struct poster_sink *to;
+	int level;
+	struct gzblock *blocks;
+	int nblocks, nthreads;
+	long filling;		/* block being filled by the writer */
+	long compressing;	/* next block for a thread */
+	long writing;		/* next block to write to the sink */
+	int quit, err;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+};
+
+struct poster_gzip *poster_gzip_open( struct poster_sink *sink,
+		struct poster_sink *to, int level, int nthreads)
+{
+	struct poster_gzip *gz;
+	int i;
+
+	if (nthreads <= 0)
+		nthreads = sysconf( _SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) nthreads = 1;
+	if (!(gz = calloc( 1, sizeof( *gz))))
+		return NULL;
+	gz->to = to;
+	gz->level = level < 1 ? 1 : level > 9 ? 9 : level;
+	gz->nblocks = 2 * nthreads;
+	gz->blocks = calloc( gz->nblocks, sizeof( struct gzblock));
+	gz->threads = calloc( nthreads, sizeof( pthread_t));
+	if (!gz->blocks || !gz->threads)
+	{	free( gz->blocks);
+		free( gz->threads);
+		free( gz);
+		return NULL;
+	}
+	for (i = 0; i < gz->nblocks; i++)
+		if (!(gz->blocks[i].in = malloc( GzBlockSize)))
+			gz->err = 1;
+	pthread_mutex_init( &gz->lock, NULL);
+	pthread_cond_init( &gz->work, NULL);
+	pthread_cond_init( &gz->done, NULL);
+	for (i = 0; i < nthreads && !gz->err; i++, gz->nthreads++)
+		if (pthread_create( &gz->threads[i], NULL, gzworker, gz))
+			gz->err = 1;
+	if (gz->err)
+	{	poster_gzip_close( gz);
+		return NULL;
+	}
+
+	sink->write = sink_gzip;
+	sink->handle = gz;
+	return gz;
+}
+
+/* write the last block, wait for all, and free everything */
+int poster_gzip_close( struct poster_gzip *gz)
+{
+	int i, err;
+
+	/* the last block, also when there was no output at all */
+	if (!gzerr( gz) && (gz->blocks[ gz->filling % gz->nblocks].inlen > 0 ||
+			 gz->filling == 0))
+		gzsubmit( gz);
+	pthread_mutex_lock( &gz->lock);
+	while (!gz->err && gz->writing < gz->filling)
+	{	pthread_mutex_unlock( &gz->lock);
+		gzdrain( gz, 1);
+		pthread_mutex_lock( &gz->lock);
+	}
+	gz->quit = 1;
+	pthread_cond_broadcast( &gz->work);
+	pthread_mutex_unlock( &gz->lock);
+
+	for (i = 0; i < gz->nthreads; i++)
+		pthread_join( gz->threads[i], NULL);
+	for (i = 0; i < gz->nblocks; i++)
+	{	free( gz->blocks[i].in);
+		free( gz->blocks[i].out);
+	}
+	pthread_mutex_destroy( &gz->lock);
+	pthread_cond_destroy( &gz->work);
+	pthread_cond_destroy( &gz->done);
+	err = gz->err;
+	free( gz->blocks);
+	free( gz->threads);
+	free( gz);
+	return err ? -1 : 0;
+}
+
+static int sink_gzip( void *handle, const char *buf, size_t n)
+{
+	struct poster_gzip *gz = handle;
+	struct gzblock *b;
+	size_t l;
+
+	while (n > 0 && !gzerr( gz))
+	{	b = gz->blocks + gz->filling % gz->nblocks;
+		l = GzBlockSize - b->inlen < n ? GzBlockSize - b->inlen : n;
+		memcpy( b->in + b->inlen, buf, l);
+		b->inlen += l;
+		buf += l;
+		n -= l;
+		if (b->inlen == GzBlockSize)
+			gzsubmit( gz);
+	}
+	return gzerr( gz) ? -1 : 0;
+}
+
+/* hand the block being filled to the threads, and get the next */
+/* free one, writing finished blocks on the way */
+static void gzsubmit( struct poster_gzip *gz)
+{
+	pthread_mutex_lock( &gz->lock);
+	gz->blocks[ gz->filling % gz->nblocks].state = GzFull;
+	gz->filling++;
+	pthread_cond_signal( &gz->work);
+	pthread_mutex_unlock( &gz->lock);
+
+	gzdrain( gz, 0);
+	while (gzbusy( gz))
+		gzdrain( gz, 1);
+}
+
+/* is the block to fill next still being compressed or written? */
+static int gzbusy( struct poster_gzip *gz)
+{
+	int busy;
+
+	pthread_mutex_lock( &gz->lock);
+	busy = !gz->err && gz->blocks[ gz->filling % gz->nblocks].state != GzFree;
+	pthread_mutex_unlock( &gz->lock);
+	return busy;
+}
+
+/* has a thread failed to compress, or the sink to write? */
+static int gzerr( struct poster_gzip *gz)
+{
+	int err;
+
+	pthread_mutex_lock( &gz->lock);
+	err = gz->err;
+	pthread_mutex_unlock( &gz->lock);
+	return err;
+}
+
+/* write the finished blocks in order; */
+/* with wait, wait for at least one first */
+static void gzdrain( struct poster_gzip *gz, int wait)
+{
+	struct gzblock *b;
+	int bad;
+
+	pthread_mutex_lock( &gz->lock);
+	b = gz->blocks + gz->writing % gz->nblocks;
+	if (wait)
+		while (!gz->err && gz->writing < gz->filling && b->state != GzDone)
+			pthread_cond_wait( &gz->done, &gz->lock);
+	while (!gz->err && gz->writing < gz->filling && b->state == GzDone)
+	{	pthread_mutex_unlock( &gz->lock);
+		bad = gz->to->write( gz->to->handle, b->out, b->outlen) < 0;
+		pthread_mutex_lock( &gz->lock);
+		if (bad)
+			gz->err = 1;
+		b->inlen = 0;
+		b->state = GzFree;
+		gz->writing++;
+		b = gz->blocks + gz->writing % gz->nblocks;
+	}
+	pthread_mutex_unlock( &gz->lock);
+}
+
+/* compress blocks into gzip members */
+static void *gzworker( void *arg)
+{
+	struct poster_gzip *gz = arg;
+	struct gzblock *b;
+	z_stream zs;
+	size_t bound;
+	char *p;
+	int r;
+
+	for (;;)
+	{	pthread_mutex_lock( &gz->lock);
+		while (!gz->quit && gz->compressing == gz->filling)
+			pthread_cond_wait( &gz->work, &gz->lock);
+		if (gz->quit)
+		{	pthread_mutex_unlock( &gz->lock);
+			break;
+		}
+		b = gz->blocks + gz->compressing++ % gz->nblocks;
+		b->state = GzBusy;
+		pthread_mutex_unlock( &gz->lock);
+
+		memset( &zs, 0, sizeof( zs));
+		r = deflateInit2( &zs, gz->level, Z_DEFLATED, 15+16, 8,
+				  Z_DEFAULT_STRATEGY);
+		if (r == Z_OK)
+		{	bound = deflateBound( &zs, b->inlen);
+			if (bound > b->outsize)
+			{	if ((p = realloc( b->out, bound)))
+				{	b->out = p;
+					b->outsize = bound;
+				} else	r = Z_MEM_ERROR;
+			}
+		}
+		if (r == Z_OK)
+		{	zs.next_in = (Bytef *)b->in;
+			zs.avail_in = b->inlen;
+			zs.next_out = (Bytef *)b->out;
+			zs.avail_out = b->outsize;
+			r = deflate( &zs, Z_FINISH) == Z_STREAM_END ? Z_OK : Z_BUF_ERROR;
+			b->outlen = b->outsize - zs.avail_out;
+			deflateEnd( &zs);
+		}
+
+		pthread_mutex_lock( &gz->lock);
+		if (r != Z_OK)
+			gz->err = 1;
+		b->state = GzDone;
+		pthread_cond_broadcast( &gz->done);
+		pthread_mutex_unlock( &gz->lock);
+	}
+	return NULL;
+}
+
@@ -10,23 +10,15 @@
 #  (encapsulated postscript) conventions but it will work for many
 #  'normal' postscript files as well.
 #
+#  This file is only the command line interface, the real work is
+#  done in libposter.c (see poster.h for its interface).
+#
 #  Compile this program with:
-#        cc -O -o poster poster.c -lm
+#        cc -O -o poster poster.c libposter.c -lm -lpthread -lz
 #  or something alike.
 #
 #  Maybe you want to change the `DefaultMedia' and `DefaultImage'
-#  settings in the few lines below, to reflect your local situation.
-#  Names can to be chosen from the `mediatable' further down.
-#
-#  The `Gv_gs_orientbug 1' disables a feature of this program to
-#  ask for landscape previewing of rotated images.
-#  Our currently installed combination of ghostview 1.5 with ghostscript 3.33
-#  cannot properly do a landscape viewing of the `poster' output.
-#  The problem does not exist in combination with an older ghostscript 2.x,
-#  and has the attention of the ghostview authors.
-#  (The problem is in the evaluation of the `setpagedevice' call.)
-#  If you have a different previewing environment,
-#  you might want to set `Gv_gs_orientbug 0'
+#  settings, to reflect your local situation: see poster.h.
 #
 # --------------------------------------------------------------
 #  This program is free software; you can redistribute it and/or
@@ -42,823 +34,812 @@
 # email: J.T.J.v.Eijndhoven@ele.tue.nl
 */
 
-#define Gv_gs_orientbug 1
-#define DefaultMedia  "A4"
-#define DefaultImage  "A4"
-#define DefaultCutMargin "5%"
-#define DefaultWhiteMargin "0"
-#define BUFSIZE 1024
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <ctype.h>
-#include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#define BUFSIZE 1024
+#define DefaultQueue 64
+
+#include "poster.h"
 
 
 extern char *optarg;        /* silently set by getopt() */
 extern int optind, opterr;  /* silently set by getopt() */
 
 static void usage();
-static void dsc_head1();
-static int dsc_infile( double ps_bb[4]);
-static void dsc_head2( void);
-static void printposter( void);
-static void printprolog();
-static void tile ( int row, int col);
-static void printfile( void);
-static void postersize( char *scalespec, char *posterspec);
-static void box_convert( char *boxspec, double psbox[4]);
-static void boxerr( char *spec);
-static void margin_convert( char *spec, double margin[2]);
-static int mystrncasecmp( const char *s1, const char *s2, int n);
-
-int verbose;
-char *myname;
-char *infile;
-int rotate, nrows, ncols;
-int manualfeed = 0;
-int tail_cntl_D = 0;
-#define Xl 0
-#define Yb 1
-#define Xr 2
-#define Yt 3
-#define X 0
-#define Y 1
-double posterbb[4];	/* final image in ps units */
-double imagebb[4];	/* original image in ps units */
-double mediasize[4];	/* [34] = size of media to print on, [01] not used! */
-double cutmargin[2];
-double whitemargin[2];
-double scale;		/* linear scaling factor */
-
-/* defaults: */
-char *imagespec = NULL;
-char *posterspec = NULL;
-char *mediaspec = NULL;
-char *cutmarginspec = NULL;
-char *whitemarginspec = NULL;
-char *scalespec = NULL;
-char *filespec = NULL;
-
-/* media sizes in ps units (1/72 inch) */
-static char *mediatable[][2] =
-{	{ "Letter",   "612,792"},
-	{ "Legal",    "612,1008"},
-	{ "Tabloid",  "792,1224"},
-	{ "Ledger",   "792,1224"},
-	{ "Executive","540,720"},
-	{ "Monarch",  "279,540"},
-	{ "Statement","396,612"},
-	{ "Folio",    "612,936"},
-	{ "Quarto",   "610,780"},
-	{ "C5",       "459,649"},
-	{ "B4",       "729,1032"},
-	{ "B5",       "516,729"},
-	{ "Dl",       "312,624"},
-	{ "A0",	      "2380,3368"},
-	{ "A1",	      "1684,2380"},
-	{ "A2",	      "1190,1684"},
-	{ "A3",	      "842,1190"},
-	{ "A4",       "595,842"},
-	{ "A5",	      "420,595"},
-	{ "A6",	      "297,421"},
-
-	/* as fall-back: linear units of measurement: */
-	{ "p",        "1,1"},
-	{ "i",        "72,72"},
-	{ "ft",       "864,864"},
-	{ "mm",       "2.83465,2.83465"},
-	{ "cm",       "28.3465,28.3465"},
-	{ "m",        "2834.65,2834.65"},
-	{ NULL, NULL}
-};
+static void error( struct poster_job *job);
+static int batch( struct poster_job *job, char **files, int nfiles,
+		  char *pattern, int nthreads);
+static int plan( struct poster_job *job);
+static int serve( struct poster_job *job, char *path, int nthreads, int qsize);
+static void *serveworker( void *arg);
+static void request( struct poster_job *job, int fd, double queued);
+static int readline( int fd, char *buf, int size);
+static int jobarg( struct poster_job *job, char *arg);
+static int client( struct poster_job *job, char *path);
+static int sendstr( int fd, char *str);
+static int sendopt( int fd, int opt, char *val);
+static int countwrite( void *handle, const char *buf, size_t n);
+static void quit( int sig);
+static double now( void);
 
+char *myname;
 
 int main( int argc, char *argv[])
 {
 	int opt;
-	double ps_bb[4];
-	int got_bb;
+	struct poster_job job;
+	struct poster_sink sink;
+	char *filespec = NULL;
+	char *spillspec = NULL;
+	char *splitspec = NULL;	/* file name pattern, with a %d for the group */
+	int ngroups = 0;	/* number of files, 0 means one per tile */
+	int nthreads = 0;	/* parallel writers, 0 means one per cpu */
+	int nfiles;
+	char *servespec = NULL;	/* socket to serve on */
+	char *clientspec = NULL;	/* socket to send the job to */
+	int qsize = DefaultQueue;	/* pending requests of the service */
+	char *statsspec = NULL;	/* file for the statistics of the run */
+	char *writespec = NULL;
+	char *mediafile = NULL;	/* media to add to the built-in ones */
+	char *cachespec = NULL;
+	int outfd = 1;		/* the poster goes here */
+	int planonly = 0;	/* only show the possible layouts */
+	FILE *fp;
 
 	myname = argv[0];
+	poster_init( &job);
+	job.creator = myname;
+	job.log = stderr;
 
-	while ((opt = getopt( argc, argv, "vfi:c:w:m:p:s:o:")) != EOF)
+	while ((opt = getopt( argc, argv, "vfFkPrSni:c:w:m:M:p:s:t:o:b:O:g:j:D:C:q:X:K:Q:z:J:W:L:R:")) != EOF)
 	{	switch( opt)
-		{ case 'v':	verbose++; break;
-		  case 'f':     manualfeed = 1; break;
-		  case 'i':	imagespec = optarg; break;
-		  case 'c':	cutmarginspec = optarg; break;
-		  case 'w':	whitemarginspec = optarg; break;
-		  case 'm':	mediaspec = optarg; break;
-		  case 'p':	posterspec = optarg; break;
-		  case 's':	scalespec = optarg; break;
+		{ case 'v':	job.verbose++; break;
+		  case 'f':     job.manualfeed = 1; break;
+		  case 'F':     job.formmode = 1; break;
+		  case 'k':     job.wholeimage = 1; break;
+		  case 'P':     job.pagemode = 1; break;
+		  case 'r':     job.hoist = 1; break;
+		  case 'S':     job.strict = 1; break;
+		  case 'n':     planonly = 1; break;
+		  case 'i':	job.imagespec = optarg; break;
+		  case 'c':	job.cutmarginspec = optarg; break;
+		  case 'w':	job.whitemarginspec = optarg; break;
+		  case 'm':	job.mediaspec = optarg; break;
+		  case 'M':	mediafile = optarg; break;
+		  case 'p':	job.posterspec = optarg; break;
+		  case 's':	job.scalespec = optarg; break;
+		  case 't':	job.tilespec = optarg; break;
 		  case 'o':     filespec = optarg; break;
+		  case 'b':     spillspec = optarg; break;
+		  case 'O':     splitspec = optarg; break;
+		  case 'g':     ngroups = atoi( optarg); break;
+		  case 'j':     nthreads = atoi( optarg); break;
+		  case 'D':     servespec = optarg; break;
+		  case 'C':     clientspec = optarg; break;
+		  case 'q':     qsize = atoi( optarg); break;
+		  case 'X':     job.indexdir = optarg; break;
+		  case 'K':     job.cachedir = optarg; break;
+		  case 'Q':     cachespec = optarg; break;
+		  case 'z':     job.gzlevel = atoi( optarg); break;
+		  case 'J':     statsspec = optarg; break;
+		  case 'W':     writespec = optarg; break;
+		  case 'L':     job.maxsheets = atoi( optarg); break;
+		  case 'R':     job.rollspec = optarg; break;
 		  default:	usage(); break;
 		}
 	}
 
 	/*** check command line arguments ***/
-	if (scalespec && posterspec)
-	{	fprintf( stderr, "Please don't specify both -s and -o, ignoring -s!\n");
-		scalespec = NULL;
+	if (job.scalespec && job.posterspec)
+	{	fprintf( stderr, "Please don't specify both -s and -p, ignoring -s!\n");
+		job.scalespec = NULL;
 	}
 
 	if (optind < argc)
-		infile = argv[ optind];
-	else
-	{	fprintf( stderr, "Filename argument missing!\n");
-		usage();
-	}
-
-	/*** decide on media size ***/
-	if (!mediaspec)
-	{	mediaspec = DefaultMedia;
-		if (verbose)
-			fprintf( stderr,
-				"Using default media of %s\n",
-				mediaspec);
+		job.infile = argv[ optind];	/* else, or '-': read stdin */
+	nfiles = argc - optind;
+
+	if (spillspec && poster_size_convert( &job, spillspec, &job.spillsize) < 0)
+		error( &job);
+	if (writespec && poster_size_convert( &job, writespec, &job.writesize) < 0)
+		error( &job);
+	if (cachespec && poster_size_convert( &job, cachespec, &job.cachesize) < 0)
+		error( &job);
+	/* the service resolves the media names of a client */
+	if (!mediafile)
+		mediafile = getenv( "POSTER_MEDIA");
+	if (mediafile && *mediafile && !clientspec &&
+	    !(job.mediadb = poster_mediadb_load( &job, mediafile)))
+		error( &job);
+
+	if (splitspec)
+	{	if (filespec)
+		{	fprintf( stderr, "Please don't specify both -o and -O, ignoring -o!\n");
+			filespec = NULL;
+		}
+		if (poster_checkpattern( &job, splitspec) < 0)
+			error( &job);
 	}
-	box_convert( mediaspec, mediasize);
-	if (mediasize[3] < mediasize[2])
-	{	fprintf( stderr, "Media should always be specified in portrait format!\n");
+	if (ngroups < 0 || nthreads < 0 || qsize < 1 || job.maxsheets < 0)
+	{	fprintf( stderr, "Group, thread and sheet counts should not be negative!\n");
 		exit(1);
 	}
-	if (mediasize[2]-mediasize[0] <= 10.0 || mediasize[3]-mediasize[1] <= 10.0)
-	{	fprintf( stderr, "Media size is ridiculous!\n");
+	if (job.gzlevel < 0 || job.gzlevel > 9)
+	{	fprintf( stderr, "Compression level should be 1 to 9!\n");
 		exit(1);
 	}
-
-	/*** defaulting poster size ? **/
-	if (!scalespec && !posterspec)
-	{	/* inherit postersize from given media size */
-		posterspec = mediaspec;
-		if (verbose)
-			fprintf( stderr,
-				"Defaulting poster size to media size of %s\n",
-				mediaspec);
+	job.gzthreads = nthreads;
+	if (statsspec && (servespec || clientspec || nfiles > 1))
+	{	fprintf( stderr, "Statistics are kept for a single job only, ignoring -J!\n");
+		statsspec = NULL;
 	}
+	job.tilestats = statsspec != NULL;
 
-	/*** decide the cutmargin size, after knowing media size ***/
-	if (!cutmarginspec)
-	{	/* if (!strcmp( posterspec, mediaspec)) */
-			/* zero cutmargin if printing to 1 sheet */
-		/*	marginspec = "0%";
-		else */	cutmarginspec = DefaultCutMargin;
-		if (verbose)
-			fprintf( stderr,
-				"Using default cutmargin of %s\n",
-				cutmarginspec);
-	}
-	margin_convert( cutmarginspec, cutmargin);
-
-	/*** decide the whitemargin size, after knowing media size ***/
-	if (!whitemarginspec)
-	{	whitemarginspec = DefaultWhiteMargin;
-		if (verbose)
-			fprintf( stderr,
-				"Using default whitemargin of %s\n",
-				whitemarginspec);
+	if (servespec)
+		exit( serve( &job, servespec, nthreads, qsize));
+	if (clientspec)
+	{	if (filespec && !freopen( filespec, "w", stdout))
+		{	fprintf( stderr, "Cannot open '%s' for writing!\n",
+				 filespec);
+			exit(1);
+		}
+		exit( client( &job, clientspec));
 	}
-	margin_convert( whitemarginspec, whitemargin);
 
+	/*** decide on media size and margins ***/
+	if (poster_media( &job) < 0)
+		error( &job);
+
+	if (planonly)
+		exit( plan( &job));
+
+	if (nfiles > 1)
+	{	/* several input files: convert them all with the same settings */
+		if (splitspec)
+			fprintf( stderr, "Cannot split several input files, ignoring -O!\n");
+		exit( batch( &job, argv + optind, nfiles,
+			     filespec ? filespec : job.gzlevel ?
+				DefaultBatchName ".gz" : DefaultBatchName,
+			     nthreads));
+	}
 
 	/******************* now start doing things **************************/
 	/* open output file */
 	if (filespec)
-	{	if (!freopen( filespec, "w", stdout))
+	{	if ((outfd = open( filespec, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
 		{	fprintf( stderr, "Cannot open '%s' for writing!\n",
 				 filespec);
 			exit(1);
-		} else if (verbose)
+		} else if (job.verbose)
 			fprintf( stderr, "Opened '%s' for writing\n",
 				 filespec);
 	}
 
 	/******* I might need to read some input to find picture size ********/
-	/* start DSC header on output */
-	dsc_head1();
-
-	/* pass input DSC lines to output, get BoundingBox spec if there */
-	got_bb = dsc_infile( ps_bb);
-
-	/**** decide the input image bounding box ****/
-	if (!got_bb && !imagespec)
-	{	imagespec = DefaultImage;
-		if (verbose)
-			fprintf( stderr,
-				"Using default input image of %s\n",
-				imagespec);
-	}
-	if (imagespec)
-		box_convert( imagespec, imagebb);
-	else
-	{	int i;
-		for (i=0; i<4; i++)
-			imagebb[i] = ps_bb[i];
-	}
+	if (poster_read( &job) < 0 || poster_layout( &job) < 0)
+		error( &job);
 
-	if (verbose > 1)
-		fprintf( stderr, "   Input image is: [%g,%g,%g,%g]\n",
-			imagebb[0], imagebb[1], imagebb[2], imagebb[3]);
+	if (splitspec)
+	{	if (poster_split( &job, splitspec, ngroups, nthreads) < 0)
+			error( &job);
+	} else
+	{	/* a file of our own gets its room beforehand */
+		if (filespec && !job.gzlevel)
+			poster_reserve( outfd, poster_outsize( &job, 0, job.ntiles));
+		poster_fd_sink( &sink, outfd);
+		if (poster_output( &job, &sink, 0, job.ntiles) < 0 ||
+		    (filespec && (poster_trim( outfd) < 0 || close( outfd) < 0)))
+		{	fprintf( stderr, "%s: write error!\n", myname);
+			exit(1);
+		}
+	}
 
-	if (imagebb[2]-imagebb[0] <= 0.0 || imagebb[3]-imagebb[1] <= 0.0)
-	{	fprintf( stderr, "Input image should have positive size!\n");
-		exit(1);
+	if (statsspec)
+	{	/* '-' for stderr: stdout may well be the poster */
+		if (!(fp = strcmp( statsspec, "-") ? fopen( statsspec, "w") : stderr))
+		{	fprintf( stderr, "Cannot open '%s' for writing!\n",
+				 statsspec);
+			exit(1);
+		}
+		if (poster_stats_json( &job, fp) < 0 ||
+		    (fp != stderr && fclose( fp)))
+		{	fprintf( stderr, "%s: write error on '%s'!\n",
+				myname, statsspec);
+			exit(1);
+		}
 	}
 
+	poster_free( &job);
+	poster_mediadb_free( job.mediadb);
+	exit (0);
+}
 
-	/*** decide on the scale factor and poster size ***/
-	postersize( scalespec, posterspec);
+/* convert many files, and report how each went */
+static int batch( struct poster_job *job, char **files, int nfiles,
+		  char *pattern, int nthreads)
+{
+	struct poster_result *results, *r;
+	int i, nfailed;
 
-	if (verbose > 1)
-		fprintf( stderr, "   Output image is: [%g,%g,%g,%g]\n",
-			posterbb[0], posterbb[1], posterbb[2], posterbb[3]);
+	if (!(results = calloc( nfiles, sizeof( *results))))
+	{	fprintf( stderr, "%s: out of memory!\n", myname);
+		return 1;
+	}
+	if ((nfailed = poster_batch( job, files, nfiles, pattern, nthreads,
+				     results)) < 0)
+		error( job);
+
+	for (i = 0; i < nfiles; i++)
+	{	r = results + i;
+		if (r->status < 0)
+			fprintf( stderr, "%s: %s\n", r->infile, r->errmsg);
+		else
+			fprintf( stderr, "%s -> %s: %d page%s, %ld bytes, %.3f s\n",
+				r->infile, r->outfile, r->npages,
+				r->npages==1?"":"s", r->bytes, r->seconds);
+	}
+	fprintf( stderr, "%d of %d files converted\n",
+		nfiles - nfailed, nfiles);
+	free( results);
+	return nfailed ? 1 : 0;
+}
 
-	
-	dsc_head2();
+/* show the ways to print the poster, best first */
+static int plan( struct poster_job *job)
+{
+	struct poster_plan *plans, *p;
+	char grid[32];
+	int i, n;
 
-	printposter();
+	/* with -i, the input is not needed at all */
+	if ((job->infile || !job->imagespec) && poster_readheader( job) < 0)
+		error( job);
+	if ((n = poster_plan( job, NULL, 0)) < 0)
+		error( job);
+	if (!(plans = calloc( n + 1, sizeof( *plans))))
+	{	fprintf( stderr, "%s: out of memory!\n", myname);
+		return 1;
+	}
+	poster_plan( job, plans, n);
+
+	printf( "# %-10s %-9s %5s %6s %9s %8s %10s %10s %6s %10s\n",
+		"media", "way", "grid", "sheets", "scale", "paper_m2",
+		"last_col", "last_row", "waste", "bytes");
+	for (i = 0; i < n; i++)
+	{	p = plans + i;
+		snprintf( grid, sizeof( grid), "%dx%d", p->ncols, p->nrows);
+		printf( "%-12s %-9s %5s %6d %9.4f %8.3f %10s %10s %5.1f%% %10ld\n",
+			p->media, p->rotate ? "landscape" : "portrait", grid,
+			p->nsheets, p->scale, p->smallpaper,
+			p->lastcol[0] ? p->lastcol : "-",
+			p->lastrow[0] ? p->lastrow : "-",
+			100 * p->waste, p->bytes);
+	}
+	free( plans);
+	poster_free( job);
+	return 0;
+}
 
-	exit (0);
+static void error( struct poster_job *job)
+{
+	fprintf( stderr, "%s\n", job->errmsg);
+	if (job->errbox)
+		poster_boxhelp( job, stderr);
+	exit(1);
 }
 
 static void usage()
 {
-	fprintf( stderr, "Usage: %s <options> infile\n\n", myname);
+	fprintf( stderr, "Usage: %s <options> [infile ...]\n\n", myname);
 	fprintf( stderr, "options are:\n");
 	fprintf( stderr, "   -v:         be verbose\n");
 	fprintf( stderr, "   -f:         ask manual feed on plotting/printing device\n");
+	fprintf( stderr, "   -F:         send input only once, as a reusable form (level-2 devices)\n");
+	fprintf( stderr, "   -k:         keep an image whole, instead of cropping it to each tile\n");
+	fprintf( stderr, "   -P:         tile each %%%%Page (or PDF page) of the input by itself\n");
+	fprintf( stderr, "   -r:         send the resources of the input prolog once, not with every tile\n");
+	fprintf( stderr, "   -S:         make every page independent of the others, with full DSC\n");
+	fprintf( stderr, "   -n:         only show the layouts on all media, best first (no output)\n");
 	fprintf( stderr, "   -i<box>:    specify input image size\n");
 	fprintf( stderr, "   -c<margin>: horizontal and vertical cutmargin\n");
 	fprintf( stderr, "   -w<margin>: horizontal and vertical additional white margin\n");
 	fprintf( stderr, "   -m<box>:    media paper size\n");
+	fprintf( stderr, "   -M<file>:   add the media names and sizes of <file> ($POSTER_MEDIA)\n");
 	fprintf( stderr, "   -p<box>:    output poster size\n");
 	fprintf( stderr, "   -s<number>: linear scale factor for poster\n");
-	fprintf( stderr, "   -o<file>:   output redirection to named file\n\n");
+	fprintf( stderr, "   -R<length>: print on a roll of the media width, in strips up to this long\n");
+	fprintf( stderr, "   -L<number>: refuse posters of more sheets than this (0: no limit)\n");
+	fprintf( stderr, "   -t<tiles>:  print only these tiles, like '3,5-7' or '2:1-3' (row:col)\n");
+	fprintf( stderr, "   -o<file>:   output redirection to named file\n");
+	fprintf( stderr, "               with several infiles: names like '%%s.ps'\n");
+	fprintf( stderr, "   -b<size>:   keep at most <size> bytes of piped input in memory\n");
+	fprintf( stderr, "   -W<size>:   write the output on a thread, in buffers of <size> bytes (0: not)\n");
+	fprintf( stderr, "   -X<dir>:    keep input scan results in <dir>, for repeated runs\n");
+	fprintf( stderr, "   -K<dir>:    keep outputs in <dir>, and reuse them for the same job\n");
+	fprintf( stderr, "   -Q<size>:   with -K, keep at most <size> bytes of outputs\n");
+	fprintf( stderr, "   -z<level>:  gzip the output at level 1 to 9, on -j threads\n");
+	fprintf( stderr, "   -J<file>:   write statistics and timing of the run as JSON ('-': stderr)\n");
+	fprintf( stderr, "   -O<file>:   write tiles to separate files, named like 'tile%%02d.ps'\n");
+	fprintf( stderr, "   -g<number>: with -O, balance the tiles over this number of files\n");
+	fprintf( stderr, "   -j<number>: with -O or infiles, number of files written in parallel\n");
+	fprintf( stderr, "   -D<socket>: serve poster jobs on a unix socket, options are defaults\n");
+	fprintf( stderr, "   -q<number>: with -D, number of waiting jobs before refusing more\n");
+	fprintf( stderr, "   -C<socket>: let the poster service on socket do this job\n\n");
 	fprintf( stderr, "   At least one of -s -p -m is mandatory, and don't give both -s and -p\n"); 
 	fprintf( stderr, "   <box> is like 'A4', '3x3letter', '10x25cm', '200x200+10,10p'\n");
 	fprintf( stderr, "   <margin> is either a simple <box> or <number>%%\n\n");
 
-	fprintf( stderr, "   Defaults are: '-m%s', '-c%s', '-i<box>' read from input file.\n",
-		DefaultMedia, DefaultCutMargin);
-	fprintf( stderr, "                 and output written to stdout.\n");
+	fprintf( stderr, "   Defaults are: '-m%s', '-c%s', '-L%s', '-i<box>' read from input file.\n",
+		DefaultMedia, DefaultCutMargin, DefaultMaxSheets);
+	fprintf( stderr, "                 '-b%s', '-W%s', '-Q%s', input read from stdin if no infile or '-',\n",
+		DefaultSpillSize, DefaultWriteSize, DefaultCacheSize);
+	fprintf( stderr, "                 and output written to stdout, or with several infiles\n");
+	fprintf( stderr, "                 to '-o%s' (with -z: '-o%s.gz').\n",
+		DefaultBatchName, DefaultBatchName);
 
 	exit(1);
 }
 
-#define exch( x, y)	{double h; h=x; x=y; y=h;}
-
-static void postersize( char *scalespec, char *posterspec)
-{	/* exactly one the arguments is NULL ! */
-	/* media and image sizes are fixed already */
-
-	int nx0, ny0, nx1, ny1;
-	double sizex, sizey;    /* size of the scaled image in ps units */
-	double drawablex, drawabley; /* effective drawable size of media */
-	double mediax, mediay;
-	double tmpposter[4];
-	
-	/* available drawing area per sheet: */
-	drawablex = mediasize[2] - 2.0*cutmargin[0];
-	drawabley = mediasize[3] - 2.0*cutmargin[1];
-
-	/*** decide on number of pages  ***/
-	if (scalespec)
-	{	/* user specified scale factor */
-		scale = atof( scalespec);
-		if (scale < 0.01 || scale > 1.0e6)
-		{	fprintf( stderr, "Illegal scale value %s!\n", scalespec);
-			exit(1);
-		}
-		sizex = (imagebb[2] - imagebb[0]) * scale + 2*whitemargin[0];
-		sizey = (imagebb[3] - imagebb[1]) * scale + 2*whitemargin[1];
+/*********************************************/
+/* service on a unix socket: each connection */
+/* is one job, answered with the postscript  */
+/*********************************************/
+struct service {
+	struct poster_job *job;	/* template with the default settings */
+	int *queue;		/* accepted connections, waiting for a worker */
+	double *queued;		/* ...and when they came in */
+	int qsize, qhead, qlen;
+	pthread_mutex_t lock;
+	pthread_cond_t more;
+	/* statistics */
+	long njobs, nfailed, nrefused;
+	double waittime, readtime, layouttime, outputtime;
+	double outbytes;
+};
 
-		/* without rotation */
-		nx0 = ceil( sizex / drawablex);
-		ny0 = ceil( sizey / drawabley);
+static struct service service;
+static char *servepath;
 
-		/* with rotation */
-		nx1 = ceil( sizex / drawabley);
-		ny1 = ceil( sizey / drawablex);
+/* a sink that counts what passes */
+struct counter {
+	struct poster_sink sink;
+	long count;
+};
 
-	} else
-	{	/* user specified output size */
-		box_convert( posterspec, tmpposter);
-		if (tmpposter[0]!=0.0 || tmpposter[1]!=0.0)
-		{	fprintf( stderr, "Poster lower-left coordinates are assumed 0!\n");
-			tmpposter[0] = tmpposter[1] = 0.0;
+static int serve( struct poster_job *job, char *path, int nthreads, int qsize)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	pthread_t thread;
+	mode_t mask;
+	int sock, fd, i, r;
+
+	if (strlen( path) >= sizeof( addr.sun_path))
+	{	fprintf( stderr, "Socket name '%s' too long!\n", path);
+		return 1;
+	}
+	memset( &addr, 0, sizeof( addr));
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path);
+
+	/* only a socket left by an earlier service may go */
+	if (lstat( path, &st) == 0)
+	{	if (!S_ISSOCK( st.st_mode))
+		{	fprintf( stderr, "Cannot serve on '%s': it exists and is "
+				"not a socket!\n", path);
+			return 1;
 		}
-		if (tmpposter[2]-tmpposter[0] <= 0.0 || tmpposter[3]-tmpposter[1] <= 0.0)
-		{	fprintf( stderr, "Poster should have positive size!\n");
-			exit(1);
+		unlink( path);
+	}
+	/* the service reads any file it can: only for its own user */
+	mask = umask( 0177);
+	r = (sock = socket( AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    bind( sock, (struct sockaddr *)&addr, sizeof( addr)) < 0;
+	umask( mask);
+	if (r || listen( sock, qsize) < 0)
+	{	fprintf( stderr, "Cannot serve on socket '%s': %s\n",
+			path, strerror( errno));
+		return 1;
+	}
+	servepath = path;
+	signal( SIGPIPE, SIG_IGN);	/* clients may hang up on us */
+	signal( SIGINT, quit);
+	signal( SIGTERM, quit);
+
+	service.job = job;
+	service.qsize = qsize;
+	service.queue = malloc( qsize * sizeof( int));
+	service.queued = malloc( qsize * sizeof( double));
+	if (!service.queue || !service.queued)
+	{	fprintf( stderr, "%s: out of memory!\n", myname);
+		return 1;
+	}
+	pthread_mutex_init( &service.lock, NULL);
+	pthread_cond_init( &service.more, NULL);
+
+	if (nthreads <= 0)
+		nthreads = sysconf( _SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) nthreads = 1;
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create( &thread, NULL, serveworker, NULL))
+		{	fprintf( stderr, "%s: cannot create thread!\n", myname);
+			return 1;
 		}
-
-		if ((tmpposter[3]-tmpposter[1]) < (tmpposter[2]-tmpposter[0]))
-		{	/* hmmm... landscape spec, change to portrait for now */
-			exch( tmpposter[0], tmpposter[1]);
-			exch( tmpposter[2], tmpposter[3]);
+	if (job->verbose)
+		fprintf( stderr, "Serving on '%s' with %d thread%s\n",
+			path, nthreads, nthreads==1?"":"s");
+
+	for (;;)
+	{	if ((fd = accept( sock, NULL, NULL)) < 0)
+		{	if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf( stderr, "Cannot accept on '%s': %s\n",
+				path, strerror( errno));
+			return 1;
 		}
-			
 
-		/* Should we tilt the poster to landscape style? */
-		if ((imagebb[3] - imagebb[1]) < (imagebb[2] - imagebb[0]))
-		{	/* image has landscape format ==> make landscape poster */
-			exch( tmpposter[0], tmpposter[1]);
-			exch( tmpposter[2], tmpposter[3]);
+		pthread_mutex_lock( &service.lock);
+		if (service.qlen == service.qsize)
+		{	/* too busy: refuse rather than pile up */
+			service.nrefused++;
+			pthread_mutex_unlock( &service.lock);
+			sendstr( fd, "ERROR Too many jobs waiting, try again later\n");
+			close( fd);
+			continue;
 		}
-
-		/* without rotation */ /* assuming tmpposter[0],[1] = 0,0 */
-		nx0 = ceil( 0.95 * tmpposter[2] / mediasize[2]);
-		ny0 = ceil( 0.95 * tmpposter[3] / mediasize[3]);
-
-		/* with rotation */
-		nx1 = ceil( 0.95 * tmpposter[2] / mediasize[3]);
-		ny1 = ceil( 0.95 * tmpposter[3] / mediasize[2]);
-		/* (rotation is considered as media versus image, which is totally */
-		/*  independent of the portrait or landscape style of the final poster) */
-	}
-
-	/* decide for rotation to get the minimum page count */
-	rotate = nx0*ny0 > nx1*ny1;
-
-	ncols = rotate ? nx1 : nx0;
-	nrows = rotate ? ny1 : ny0;
-
-	if (verbose)
-		fprintf( stderr,
-			"Deciding for %d column%s and %d row%s of %s pages.\n",
-			ncols, (ncols==1)?"":"s", nrows, (nrows==1)?"":"s",
-			rotate?"landscape":"portrait");
-
-	if (nrows * ncols > 400)
-	{	fprintf( stderr, "However %dx%d pages seems ridiculous to me!\n",
-			ncols, nrows);
-		exit(1);
+		i = (service.qhead + service.qlen++) % service.qsize;
+		service.queue[i] = fd;
+		service.queued[i] = now();
+		pthread_cond_signal( &service.more);
+		pthread_mutex_unlock( &service.lock);
 	}
+}
 
-	mediax = ncols * (rotate ? drawabley : drawablex);
-	mediay = nrows * (rotate ? drawablex : drawabley);
-
-	if (!scalespec)  /* no scaling number given by user */
-	{	double scalex, scaley;
-		scalex = (mediax - 2*whitemargin[0]) / (imagebb[2] - imagebb[0]);
-		scaley = (mediay - 2*whitemargin[1]) / (imagebb[3] - imagebb[1]);
-		scale = (scalex < scaley) ? scalex : scaley;
-
-		if (verbose)
-			fprintf( stderr,
-				"Deciding for a scale factor of %g\n", scale);
-		sizex = scale * (imagebb[2] - imagebb[0]);
-		sizey = scale * (imagebb[3] - imagebb[1]);
+/* take connection after connection from the queue */
+static void *serveworker( void *arg)
+{
+	struct poster_job job;
+	struct poster_span *spans = NULL;	/* kept warm between jobs */
+	char *dsclines = NULL;
+	size_t dscalloc = 0;
+	int maxspans = 0, fd;
+	double queued;
+
+	for (;;)
+	{	pthread_mutex_lock( &service.lock);
+		while (service.qlen == 0)
+			pthread_cond_wait( &service.more, &service.lock);
+		fd = service.queue[ service.qhead];
+		queued = service.queued[ service.qhead];
+		service.qhead = (service.qhead + 1) % service.qsize;
+		service.qlen--;
+		pthread_mutex_unlock( &service.lock);
+
+		job = *service.job;
+		job.spans = spans;
+		job.maxspans = maxspans;
+		job.dsclines = dsclines;
+		job.dscalloc = dscalloc;
+
+		request( &job, fd, queued);
+		close( fd);
+
+		/* keep the buffers for the next job */
+		spans = job.spans;
+		maxspans = job.maxspans;
+		dsclines = job.dsclines;
+		dscalloc = job.dscalloc;
+		job.spans = NULL;
+		job.dsclines = NULL;
+		poster_free( &job);
+		free( (char *)job.indata);
 	}
-
-	/* set poster size as if it were a continuous surface without margins */
-	posterbb[0] = (mediax - sizex) / 2.0; /* center picture on paper */
-	posterbb[1] = (mediay - sizey) / 2.0; /* center picture on paper */
-	posterbb[2] = posterbb[0] + sizex;
-	posterbb[3] = posterbb[1] + sizey;
-
+	return arg;
 }
 
-static void margin_convert( char *spec, double margin[2])
-{	double x;
-	int i, n;
-
-	if (1==sscanf( spec, "%lf%n", &x, &n) && x==0.0 && n==strlen(spec))
-	{	/* margin spec of 0, dont bother about a otherwise mandatory unit */
-		margin[0] = margin[1] = 0.0;
-	} else if (spec[ strlen( spec) - 1] == '%')
-	{	/* margin relative to media size */
-		if (1 != sscanf( spec, "%lf%%", &x))
-		{	fprintf( stderr, "Illegal margin specification!\n");
-			exit( 1);
+/* read a request from fd, and reply */
+static void request( struct poster_job *job, int fd, double queued)
+{
+	char buf[BUFSIZE], *data, *line, *end;
+	char lines[8*BUFSIZE];	/* all request lines: the job points into it */
+	struct counter counter;
+	struct poster_sink sink;
+	double t0, t1, t2, t3;
+	long n, got, size;
+	int r, l, used;
+
+	t0 = now();
+	size = -1;
+	job->infile = NULL;
+	job->log = NULL;	/* do not mix up job messages on the log */
+
+	/* request lines: options, input file or data size, empty line */
+	for (r = used = 0;
+	     r == 0 && (l = readline( fd, line = lines + used,
+					sizeof( lines) - used)) > 0;
+	     used += l + 1)
+	{	if (line[0] == '-' && line[1])
+			r = jobarg( job, line);
+		else if (line[0] == '@')
+		{	size = strtol( line+1, &end, 10);
+			if (end == line+1 || *end || size < 0)
+				r = -1, snprintf( job->errmsg, POSTER_MSGSIZE,
+					"Bad input size '%s'!", line+1);
+			else if ((unsigned long)size > job->spillsize)
+				r = -1, snprintf( job->errmsg, POSTER_MSGSIZE,
+					"Input data of %ld bytes is more than the "
+					"limit of %lu (see -b)!", size,
+					(unsigned long)job->spillsize);
 		}
-		margin[0] = 0.01 * x * mediasize[2];
-		margin[1] = 0.01 * x * mediasize[3];
-	} else
-	{	/* absolute margin value */
-		double marg[4];
-		box_convert( spec, marg);
-		margin[0] = marg[2];
-		margin[1] = marg[3];
-	}
-
-	for (i=0; i<2; i++)
-	{	if (margin[i] < 0 || 2.0*margin[i] >= mediasize[i+2])
-		{	fprintf( stderr, "Margin value '%s' out of range!\n",
-				spec);
-			exit(1);
+		else if (!strcmp( line, "stats"))
+		{	pthread_mutex_lock( &service.lock);
+			n = service.njobs ? service.njobs : 1;
+			snprintf( buf, BUFSIZE,
+				"OK jobs %ld failed %ld refused %ld waiting %d "
+				"avg_wait_ms %.3f avg_read_ms %.3f avg_layout_ms %.3f "
+				"avg_output_ms %.3f avg_bytes %.0f\n",
+				service.njobs, service.nfailed, service.nrefused,
+				service.qlen, 1e3*service.waittime/n,
+				1e3*service.readtime/n, 1e3*service.layouttime/n,
+				1e3*service.outputtime/n, service.outbytes/n);
+			pthread_mutex_unlock( &service.lock);
+			sendstr( fd, buf);
+			return;
 		}
+		else
+			job->infile = line;
 	}
-}
-
-static void box_convert( char *boxspec, double psbox[4])
-{	/* convert user textual box spec into numbers in ps units */
-	/* box = [fixed x fixed][+ fixed , fixed] unit */
-	/* fixed = digits [ . digits] */
-	/* unit = medianame | i | cm | mm | m | p */
-
-	double mx, my, ox, oy, ux, uy;
-	int n, r, i, l, inx;
-	char *spec;
-
-	mx = my = 1.0;
-	ox = oy = 0.0;
-
-	spec = boxspec;
-	/* read 'fixed x fixed' */
-	if (isdigit( spec[0]))
-	{	r = sscanf( spec, "%lfx%lf%n", &mx, &my, &n);
-		if (r != 2)
-		{	r = sscanf( spec, "%lf*%lf%n", &mx, &my, &n);
-			if (r != 2) boxerr( boxspec);
+	if (l < 0)
+		r = -1, snprintf( job->errmsg, POSTER_MSGSIZE, "Bad request!");
+
+	/* inline input data */
+	if (r == 0 && size >= 0)
+	{	if (!(data = malloc( size ? size : 1)))
+			r = -1, snprintf( job->errmsg, POSTER_MSGSIZE,
+				"Out of memory!");
+		for (got = 0; r == 0 && got < size; got += n)
+			if ((n = read( fd, data + got, size - got)) <= 0 &&
+			    !(n < 0 && errno == EINTR))
+				r = -1, snprintf( job->errmsg, POSTER_MSGSIZE,
+					"Input data incomplete!");
+			else if (n < 0)
+				n = 0;
+		if (r == 0 || data)
+		{	job->indata = data;
+			job->inlen = size;
 		}
-		spec += n;
 	}
 
-	/* read '+ fixed , fixed' */
-	if (1 < (r = sscanf( spec, "+%lf,%lf%n", &ox, &oy, &n)))
-	{	if (r != 2) boxerr( boxspec);
-		spec += n;
-	}
-
-	/* read unit */
-	l = strlen( spec);
-	for (n=i=0; mediatable[i][0]; i++)
-	{	if (!mystrncasecmp( mediatable[i][0], spec, l))
-		{	/* found */
-			n++;
-			inx = i;
-			if (l == strlen( mediatable[i][0]))
-			{	/* match is exact */
-				n = 1;
-				break;
-			}
-		}
-	}
-	if (!n) boxerr( boxspec);
-	if (n>1)
-	{	fprintf( stderr, "Your box spec '%s' is not unique! (give more chars)\n",
-			spec);
-		exit(1);
+	if (r == 0)
+		r = poster_media( job);
+	if (r == 0)
+		r = poster_read( job);
+	t1 = now();
+	if (r == 0)
+		r = poster_layout( job);
+	t2 = now();
+
+	counter.count = 0;
+	if (r < 0)
+	{	snprintf( buf, BUFSIZE, "ERROR %s\n", job->errmsg);
+		sendstr( fd, buf);
+	} else
+	{	sendstr( fd, "OK\n");
+		poster_socket_sink( &counter.sink, fd);
+		sink.write = countwrite;
+		sink.handle = &counter;
+		r = poster_output( job, &sink, 0, job->ntiles);
 	}
-	sscanf( mediatable[inx][1], "%lf,%lf", &ux, &uy);
-
-	psbox[0] = ox * ux;
-	psbox[1] = oy * uy;
-	psbox[2] = mx * ux;
-	psbox[3] = my * uy;
-
-	if (verbose > 1)
-		fprintf( stderr, "   Box_convert: '%s' into [%g,%g,%g,%g]\n",
-			boxspec, psbox[0], psbox[1], psbox[2], psbox[3]);
+	t3 = now();
+
+	pthread_mutex_lock( &service.lock);
+	service.njobs++;
+	service.nfailed += r < 0;
+	service.waittime += t0 - queued;
+	service.readtime += t1 - t0;
+	service.layouttime += t2 - t1;
+	service.outputtime += t3 - t2;
+	service.outbytes += counter.count;
+	n = service.njobs;
+	pthread_mutex_unlock( &service.lock);
+
+	if (service.job->verbose)
+		fprintf( stderr, "job %ld: %s %s, wait %.3f ms, read %.3f ms, "
+			"layout %.3f ms, output %.3f ms\n",
+			n, job->inname ? job->inname : "-",
+			r < 0 ? job->errmsg : "fine",
+			1e3*(t0-queued), 1e3*(t1-t0), 1e3*(t2-t1), 1e3*(t3-t2));
+}
 
-	for (i=0; i<2; i++)
-	{	if (psbox[i] < 0.0 || psbox[i+2] < psbox[i])
-		{	fprintf( stderr, "Your specification `%s' leads to "
-				"negative values!\n", boxspec);
-			exit(1);
+/* read one line, without newline; 0 on an empty line, -1 on error */
+static int readline( int fd, char *buf, int size)
+{
+	int n = 0;
+	ssize_t r;
+	char c;
+
+	/* byte by byte: the input data may follow directly */
+	while ((r = read( fd, &c, 1)) == 1 || (r < 0 && errno == EINTR))
+	{	if (r < 0) continue;
+		if (c == '\n')
+		{	buf[n] = '\0';
+			return n;
 		}
+		if (n == size-1) return -1;
+		buf[n++] = c;
 	}
+	return -1;
 }
 
-static void boxerr( char *spec)
-{	int i;
-
-	fprintf( stderr, "I don't understand your box specification `%s'!\n",
-		spec);
-
-	fprintf( stderr, "The proper format is: ([text] meaning optional text)\n");
-	fprintf( stderr, "  [multiplier][offset]unit\n");
-	fprintf( stderr, "  with multiplier:  numberxnumber\n");
-	fprintf( stderr, "  with offset:      +number,number\n");
-	fprintf( stderr, "  with unit one of:");
-
-	for (i=0; mediatable[i][0]; i++)
-		fprintf( stderr, "%c%-10s", (i%7)?' ':'\n', mediatable[i][0]);
-	fprintf( stderr, "\nYou can use a shorthand for these unit names,\n"
-		"provided it resolves unique.\n");
-	exit( 1);
+/* a command line option in a service request */
+static int jobarg( struct poster_job *job, char *arg)
+{
+	char *val = arg+2;
+
+	switch (arg[1])
+	{ case 'f':	job->manualfeed = 1; break;
+	  case 'F':	job->formmode = 1; break;
+	  case 'k':	job->wholeimage = 1; break;
+	  case 'P':	job->pagemode = 1; break;
+	  case 'r':	job->hoist = 1; break;
+	  case 'S':	job->strict = 1; break;
+	  case 'i':	job->imagespec = val; break;
+	  case 'c':	job->cutmarginspec = val; break;
+	  case 'w':	job->whitemarginspec = val; break;
+	  case 'm':	job->mediaspec = val; break;
+	  case 'p':	job->posterspec = val; job->scalespec = NULL; break;
+	  case 's':	job->scalespec = val; job->posterspec = NULL; break;
+	  case 't':	job->tilespec = val; break;
+	  case 'R':	job->rollspec = val; break;
+	  case 'z':	job->gzlevel = atoi( val);
+			if (job->gzlevel < 0 || job->gzlevel > 9)
+			{	snprintf( job->errmsg, POSTER_MSGSIZE,
+					"Option '%s' wants a level of 1 to 9!", arg);
+				return -1;
+			}
+			break;
+	  default:
+		snprintf( job->errmsg, POSTER_MSGSIZE,
+			"Option '%s' not allowed in a request!", arg);
+		return -1;
+	}
+	return 0;
 }
 
-/*********************************************/
-/* output first part of DSC header           */
-/*********************************************/
-static void dsc_head1()
+static void quit( int sig)
 {
-	printf ("%%!PS-Adobe-3.0\n");
-	printf ("%%%%Creator: %s\n", myname);
+	unlink( servepath);
+	_exit( 0);
 }
 
 /*********************************************/
-/* pass some DSC info from the infile in the new DSC header */
-/* such as document fonts and */
-/* extract BoundingBox info from the PS file */
+/* let the service do the job, and copy its  */
+/* answer to stdout                          */
 /*********************************************/
-static int dsc_infile( double ps_bb[4])
+static int client( struct poster_job *job, char *path)
 {
-	char *c, buf[BUFSIZE];
-	int gotall, atend, level, dsc_cont, inbody, got_bb;
-
-	if (freopen (infile, "r", stdin) == NULL) {
-		fprintf (stderr, "%s: fail to open file '%s'!\n",
-			myname, infile);
-		exit (1);
+	struct sockaddr_un addr;
+	char buf[BUFSIZE], name[PATH_MAX], *data = NULL;
+	char level[16];
+	size_t size = 0, alloc = 0;
+	ssize_t n;
+	int fd, ok;
+
+	memset( &addr, 0, sizeof( addr));
+	addr.sun_family = AF_UNIX;
+	strncpy( addr.sun_path, path, sizeof( addr.sun_path) - 1);
+	if ((fd = socket( AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    connect( fd, (struct sockaddr *)&addr, sizeof( addr)) < 0)
+	{	fprintf( stderr, "Cannot connect to '%s': %s\n",
+			path, strerror( errno));
+		return 1;
 	}
 
-	got_bb = 0;
-	dsc_cont = inbody = gotall = level = atend = 0;
-	while (!gotall && (gets(buf) != NULL))
-	{	
-		if (buf[0] != '%')
-		{	dsc_cont = 0;
-			if (!inbody) inbody = 1;
-			if (!atend) gotall = 1;
-			continue;
+	/* the service has its own working directory: send full names */
+	if (job->infile && strcmp( job->infile, "-"))
+	{	if (!realpath( job->infile, name))
+		{	fprintf( stderr, "%s: fail to open file '%s'!\n",
+				myname, job->infile);
+			return 1;
 		}
-
-		if (!strncmp( buf, "%%+",3) && dsc_cont)
-		{	puts( buf);
-			continue;
-		}
-
-		dsc_cont = 0;
-		if      (!strncmp( buf, "%%EndComments", 13))
-		{	inbody = 1;
-			if (!atend) gotall = 1;
-		}
-		else if (!strncmp( buf, "%%BeginDocument", 15) ||
-		         !strncmp( buf, "%%BeginData", 11)) level++;
-		else if (!strncmp( buf, "%%EndDocument", 13) ||
-		         !strncmp( buf, "%%EndData", 9)) level--;
-		else if (!strncmp( buf, "%%Trailer", 9) && level == 0)
-			inbody = 2;
-		else if (!strncmp( buf, "%%BoundingBox:", 14) &&
-			 inbody!=1 && !level)
-		{	for (c=buf+14; *c==' ' || *c=='\t'; c++);
-			if (!strncmp( c, "(atend)", 7)) atend = 1;
-			else
-			{	sscanf( c, "%lf %lf %lf %lf",
-				       ps_bb, ps_bb+1, ps_bb+2, ps_bb+3);
-				got_bb = 1;
-			}
-		}
-		else if (!strncmp( buf, "%%Document", 10) &&
-			 inbody!=1 && !level)  /* several kinds of doc props */
-		{	for (c=buf+10; *c && *c!=' ' && *c!='\t'; c++);
-			for (; *c==' ' || *c=='\t'; c++);
-			if (!strncmp( c, "(atend)", 7)) atend = 1;
-			else
-			{	/* pass this DSC to output */
-				/* if it is not another DocumentMedia comment */
-				if (strncmp( buf, "%%DocumentMedia", 15))
-				{
-					puts( buf);
-					dsc_cont = 1;
-				}
+	} else
+	{	/* from stdin: the data goes along with the request */
+		do
+		{	if (size == alloc &&
+			    !(data = realloc( data, alloc = 2*alloc + 64*1024)))
+			{	fprintf( stderr, "%s: out of memory!\n", myname);
+				return 1;
 			}
-		}
+			n = read( 0, data + size, alloc - size);
+			if (n > 0) size += n;
+		} while (n > 0 || (n < 0 && errno == EINTR));
+		snprintf( name, sizeof( name), "@%lu", (unsigned long)size);
 	}
-	return got_bb;
-}
 
-/*********************************************/
-/* output last part of DSC header            */
-/*********************************************/
-static void dsc_head2()
-{
-	printf ("%%%%Pages: %d\n", nrows*ncols);
-
-#ifndef Gv_gs_orientbug
-	printf ("%%%%Orientation: %s\n", rotate?"Landscape":"Portrait");
-#endif
-	printf ("%%%%DocumentMedia: %s %d %d 0 white ()\n",
-		mediaspec, (int)(mediasize[2]), (int)(mediasize[3]));
-	printf ("%%%%BoundingBox: 0 0 %d %d\n", (int)(mediasize[2]), (int)(mediasize[3]));
-	printf ("%%%%EndComments\n\n");
-
-	printf ("%% Print poster %s in %dx%d tiles with %.3g magnification\n", 
-		infile, nrows, ncols, scale);
-}
-
-/*********************************************/
-/* output the poster, create tiles if needed */
-/*********************************************/
-static void printposter()
-{
-	int row, col;
-
-	printprolog();
-	for (row = 1; row <= nrows; row++)
-		for (col = 1; col <= ncols; col++)
-			tile( row, col);
-	printf ("%%%%EOF\n");
+	snprintf( level, sizeof( level), "%d", job->gzlevel);
+	ok = (!job->manualfeed || sendopt( fd, 'f', "") == 0) &&
+	     (!job->formmode || sendopt( fd, 'F', "") == 0) &&
+	     (!job->wholeimage || sendopt( fd, 'k', "") == 0) &&
+	     (!job->pagemode || sendopt( fd, 'P', "") == 0) &&
+	     (!job->hoist || sendopt( fd, 'r', "") == 0) &&
+	     (!job->strict || sendopt( fd, 'S', "") == 0) &&
+	     (!job->imagespec || sendopt( fd, 'i', job->imagespec) == 0) &&
+	     (!job->cutmarginspec || sendopt( fd, 'c', job->cutmarginspec) == 0) &&
+	     (!job->whitemarginspec || sendopt( fd, 'w', job->whitemarginspec) == 0) &&
+	     (!job->mediaspec || sendopt( fd, 'm', job->mediaspec) == 0) &&
+	     (!job->posterspec || sendopt( fd, 'p', job->posterspec) == 0) &&
+	     (!job->scalespec || sendopt( fd, 's', job->scalespec) == 0) &&
+	     (!job->tilespec || sendopt( fd, 't', job->tilespec) == 0) &&
+	     (!job->rollspec || sendopt( fd, 'R', job->rollspec) == 0) &&
+	     (!job->gzlevel || sendopt( fd, 'z', level) == 0) &&
+	     sendstr( fd, name) == 0 && sendstr( fd, "\n\n") == 0;
+	if (ok && data)
+	{	struct poster_sink sink;
+		poster_socket_sink( &sink, fd);
+		ok = sink.write( sink.handle, data, size) == 0;
+	}
+	free( data);
+	if (!ok)
+	{	fprintf( stderr, "%s: cannot send request!\n", myname);
+		return 1;
+	}
 
-	if (tail_cntl_D)
-	{	printf("%c", 0x4);
+	/* status line, then the postscript */
+	if (readline( fd, buf, BUFSIZE) < 0 || strcmp( buf, "OK"))
+	{	fprintf( stderr, "%s: %s\n", myname,
+			strncmp( buf, "ERROR ", 6) ? "bad answer from service" : buf+6);
+		return 1;
 	}
+	while ((n = read( fd, buf, BUFSIZE)) > 0 || (n < 0 && errno == EINTR))
+		if (n > 0 && fwrite( buf, 1, n, stdout) != n)
+		{	fprintf( stderr, "%s: write error!\n", myname);
+			return 1;
+		}
+	return fflush( stdout) ? 1 : 0;
 }
 
-/*******************************************************/
-/* output PS prolog of the scaling and tiling routines */
-/*******************************************************/
-static void printprolog()
+static int sendstr( int fd, char *str)
 {
-	printf( "%%%%BeginProlog\n");
-
-	printf( "/cutmark	%% - cutmark -\n"
-		"{		%% draw cutline\n"
-		"	0.23 setlinewidth 0 setgray\n"
-		"	clipmargin\n"
-		"	dup 0 moveto\n"
-		"	dup neg leftmargin add 0 rlineto stroke\n"
-		"	%% draw sheet alignment mark\n"
-		"	dup dup neg moveto\n"
-		"	dup 0 rlineto\n"
-		"	dup dup lineto\n"
-		"	0 rlineto\n"
-		"	closepath fill\n"
-		"} bind def\n\n");
-
-	printf( "%% usage: 	row col tileprolog ps-code tilepilog\n"
-		"%% these procedures output the tile specified by row & col\n"
-		"/tileprolog\n"
-		"{ 	%%def\n"
-		"	gsave\n"
-		"       leftmargin botmargin translate\n"
-	        "	do_turn {exch} if\n"
-		"	/colcount exch def\n"
-		"	/rowcount exch def\n"
-		"	%% clip page contents\n"
-		"	clipmargin neg dup moveto\n"
-		"	pagewidth clipmargin 2 mul add 0 rlineto\n"
-		"	0 pageheight clipmargin 2 mul add rlineto\n"
-		"	pagewidth clipmargin 2 mul add neg 0 rlineto\n"
-		"	closepath clip\n"
-		"	%% set page contents transformation\n"
-		"	do_turn\n"
-	        "	{	pagewidth 0 translate\n"
-		"		90 rotate\n"
-	        "	} if\n"
-		"	pagewidth colcount 1 sub mul neg\n"
-		"	pageheight rowcount 1 sub mul neg\n"
-	        "	do_turn {exch} if\n"
-		"	translate\n"
-	        "	posterxl posteryb translate\n"
-		"	sfactor dup scale\n"
-	        "	imagexl neg imageyb neg translate\n"
-		"	tiledict begin\n"
-	        "	0 setgray 0 setlinecap 1 setlinewidth\n"
-	        "	0 setlinejoin 10 setmiterlimit [] 0 setdash newpath\n"
-	        "} bind def\n\n");
-
-	printf( "/tileepilog\n"
-	        "{	end %% of tiledict\n"
-	        "	grestore\n"
-	        "	%% print the cutmarks\n"
-	        "	gsave\n"
-		"       leftmargin botmargin translate\n"
-	        "	pagewidth pageheight translate cutmark 90 rotate cutmark\n"
-	        "	0 pagewidth translate cutmark 90 rotate cutmark\n"
-	        "	0 pageheight translate cutmark 90 rotate cutmark\n"
-	        "	0 pagewidth translate cutmark 90 rotate cutmark\n"
-	        "	grestore\n"
-	        "	%% print the page label\n"
-	        "	0 setgray\n"
-	        "	leftmargin clipmargin 3 mul add clipmargin labelsize add neg botmargin add moveto\n"
-	        "	(Grid \\( ) show\n"
-	        "	rowcount strg cvs show\n"
-	        "	( , ) show\n"
-	        "	colcount strg cvs show\n"
-	        "	( \\)) show\n"
-	        "	showpage\n"
-                "} bind def\n\n");
-
-	printf( "%%%%EndProlog\n\n");
-	printf( "%%%%BeginSetup\n");
-	printf( "%% Try to inform the printer about the desired media size:\n"
-	        "/setpagedevice where 	%% level-2 page commands available...\n"
-	        "{	pop		%% ignore where found\n"
-	        "	3 dict dup /PageSize [ %d %d ] put\n"
-	        "	dup /Duplex false put\n%s"
-	        "	setpagedevice\n"
-                "} if\n",
-	       (int)(mediasize[2]), (int)(mediasize[3]),
-	       manualfeed?"       dup /ManualFeed true put\n":"");
-
-	printf( "/sfactor %.10f def\n"
-	        "/leftmargin %d def\n"
-	        "/botmargin %d def\n"
-	        "/pagewidth %d def\n"
-	        "/pageheight %d def\n"
-	        "/imagexl %d def\n"
-	        "/imageyb %d def\n"
-	        "/posterxl %d def\n"
-	        "/posteryb %d def\n"
-	        "/do_turn %s def\n"
-	        "/strg 10 string def\n"
-	        "/clipmargin 6 def\n"
-	        "/labelsize 9 def\n"
-	        "/tiledict 250 dict def\n"
-	        "tiledict begin\n"
-	        "%% delay users showpage until cropmark is printed.\n"
-	        "/showpage {} def\n"
-		"/setpagedevice { pop } def\n"
-	        "end\n",
-	        scale, (int)(cutmargin[0]), (int)(cutmargin[1]),
-	        (int)(mediasize[2]-2.0*cutmargin[0]), (int)(mediasize[3]-2.0*cutmargin[1]),
-	        (int)imagebb[0], (int)imagebb[1], (int)posterbb[0], (int)posterbb[1],
-	        rotate?"true":"false");
-
-	printf( "/Helvetica findfont labelsize scalefont setfont\n");
-
-	printf( "%%%%EndSetup\n");
+	struct poster_sink sink;
+
+	poster_socket_sink( &sink, fd);
+	return sink.write( sink.handle, str, strlen( str));
 }
 
-/*****************************/
-/* output one tile at a time */
-/*****************************/
-static void tile ( int row, int col)
+/* one option line of a request, like '-mA4' */
+static int sendopt( int fd, int opt, char *val)
 {
-	static int page=1;
-
-	if (verbose) fprintf( stderr, "print page %d\n", page);
+	char buf[BUFSIZE];
 
-	printf ("\n%%%%Page: %d %d\n", page, page);
-	printf ("%d %d tileprolog\n", row, col);
-	printf ("%%%%BeginDocument: %s\n", infile);
-	printfile ();
-	printf ("\n%%%%EndDocument\n");
-	printf ("tileepilog\n");
-
-	page++;
+	snprintf( buf, BUFSIZE, "-%c%s\n", opt, val);
+	return sendstr( fd, buf);
 }
 
-/******************************/
-/* copy the PS file to output */
-/******************************/
-static void printfile ()
+static int countwrite( void *handle, const char *buf, size_t n)
 {
-	/* use a double line buffer, so that when I print */
-	/* a line, I know whether it is the last or not */
-	/* I surely dont want to print a 'cntl_D' on the last line */
-	/* The double buffer removes the need to scan each line for each page*/
-	/* Furthermore allows cntl_D within binary transmissions */
-
-	char buf[2][BUFSIZE];
-	int bp;
-	char *c;
-
-	if (freopen (infile, "r", stdin) == NULL) {
-		fprintf (stderr, "%s: fail to open file '%s'!\n",
-			myname, infile);
-		printf ("/systemdict /showpage get exec\n");
-		printf ("%%%%EOF\n");
-		exit (1);
-	}
+	struct counter *counter = handle;
 
-	/* fill first buffer for the first time */
-	fgets( buf[bp=0], BUFSIZE, stdin);
-
-	/* read subsequent lines by rotating the buffers */
-	while (fgets(buf[1-bp], BUFSIZE, stdin))
-	{	/* print line from the previous fgets */
-		/* do not print postscript comment lines: those (DSC) lines */
-		/* sometimes disturb proper previewing of the result with ghostview */
-		if (buf[bp][0] != '%')
-			fputs( buf[bp], stdout);
-		bp = 1-bp;
-	}
-
-	/* print buf from last successfull fgets, after removing cntlD */
-	for (c=buf[bp]; *c && *c != '\04'; c++);
-	if (*c == '\04')
-	{	tail_cntl_D = 1;
-		*c = '\0';
-	}
-	if (buf[bp][0] != '%' && strlen( buf[bp]))
-		fputs( buf[bp], stdout);
+	counter->count += n;
+	return counter->sink.write( counter->sink.handle, buf, n);
 }
 
-static int mystrncasecmp( const char *s1, const char *s2, int n)
-{	/* compare case-insensitive s1 and s2 for at most n chars */
-	/* return 0 if equal. */
-	/* Although standard available on some machines, */
-	/* this function seems not everywhere around... */
-
-	char c1, c2;
-	int i;
-
-	if (!s1) s1 = "";
-	if (!s2) s2 = "";
-
-	for (i=0; i<n && *s1 && *s2; i++, s1++, s2++)
-	{	c1 = tolower( *s1);
-		c2 = tolower( *s2);
-		if (c1 != c2) break;
-	}
+static double now()
+{
+	struct timespec ts;
 
-	return (i < n && (*s1 || *s2));
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
 }
@@ -0,0 +1,340 @@
+/*
+#  poster.h - library interface of poster
+#
+#  The complete scaling and tiling engine of `poster' is available
+#  as a library (libposter.a), such that a program can run many poster
+#  jobs in-process and/or on several threads without fork/exec.
+#  All state of a job lives in a `struct poster_job', the library
+#  itself has no writable global data, but for the built-in media
+#  database, made once on first use.
+#  Errors do not exit(): functions return -1 and leave a message
+#  in job->errmsg.
+#
+#  Typical use:
+#        struct poster_job job;
+#        poster_init( &job);
+#        job.infile = "image.eps";
+#        job.mediaspec = "A4";
+#        job.posterspec = "A0";
+#        if (poster_run( &job, &sink) < 0)
+#                fprintf( stderr, "%s\n", job.errmsg);
+#        poster_free( &job);
+#
+# --------------------------------------------------------------
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License
+#  as published by the Free Software Foundation.
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY;
+#  The full text of the GNU General Public License is supplied
+#  with 'poster' in the file LICENSE.
+# --------------------------------------------------------------
+*/
+
+#ifndef POSTER_H
+#define POSTER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+#  Maybe you want to change the `DefaultMedia' and `DefaultImage'
+#  settings in the few lines below, to reflect your local situation.
+#  Names can to be chosen from the `mediatable' in libposter.c.
+#
+#  The `Gv_gs_orientbug 1' disables a feature of this program to
+#  ask for landscape previewing of rotated images.
+#  Our currently installed combination of ghostview 1.5 with ghostscript 3.33
+#  cannot properly do a landscape viewing of the `poster' output.
+#  The problem does not exist in combination with an older ghostscript 2.x,
+#  and has the attention of the ghostview authors.
+#  (The problem is in the evaluation of the `setpagedevice' call.)
+#  If you have a different previewing environment,
+#  you might want to set `Gv_gs_orientbug 0'
+*/
+#define Gv_gs_orientbug 1
+#define DefaultMedia  "A4"
+#define DefaultImage  "A4"
+#define DefaultCutMargin "5%"
+#define DefaultWhiteMargin "0"
+#define DefaultSpillSize "16M"
+#define DefaultWriteSize "1M"
+#define DefaultMaxSheets "400"
+#define DefaultCacheSize "1G"
+#define DefaultBatchName "%s-poster.ps"
+
+#define POSTER_MSGSIZE 256
+
+/* where the output goes: write() must write all n bytes, */
+/* and return 0 on success or -1 on failure */
+struct poster_sink {
+	int (*write)( void *handle, const char *buf, size_t n);
+	void *handle;
+};
+
+/* sinks on a stdio stream and on a file descriptor */
+void poster_file_sink( struct poster_sink *sink, FILE *fp);
+void poster_fd_sink( struct poster_sink *sink, int fd);
+
+/* a sink on a socket, that does not raise SIGPIPE when the peer hung up */
+void poster_socket_sink( struct poster_sink *sink, int fd);
+
+/* a sink that collects the output in memory; free( mem->buf) after */
+struct poster_memory {
+	char *buf;
+	size_t len, alloc;
+};
+void poster_memory_sink( struct poster_sink *sink, struct poster_memory *mem);
+
+/* a sink that writes into sink to on a thread of its own, through */
+/* two aligned buffers of bufsize bytes: one is filled while the other */
+/* is being written. Close it to write the rest and free it. */
+struct poster_writer;
+struct poster_writer *poster_writer_open( struct poster_sink *sink,
+		struct poster_sink *to, size_t bufsize);
+int poster_writer_close( struct poster_writer *w);
+
+/* reserve disk space for size bytes of output to the regular file fd, */
+/* and cut off what was not used once the output is done */
+void poster_reserve( int fd, long size);
+int poster_trim( int fd);
+
+/* a sink that gzips into sink to, compressing blocks on nthreads */
+/* threads (0: one per cpu); the output is a series of gzip members, */
+/* as one gzip stream. Close it to write the last block and free it. */
+struct poster_gzip;
+struct poster_gzip *poster_gzip_open( struct poster_sink *sink,
+		struct poster_sink *to, int level, int nthreads);
+int poster_gzip_close( struct poster_gzip *gz);
+
+struct poster_span { size_t off, len; };
+
+/* the objects and pages of a PDF input, see libposter.c */
+struct poster_pdf;
+
+/* media names and sizes, see poster_mediadb_load() */
+struct poster_mediadb;
+
+/* a single sampled image, that each tile may crop to its own part */
+struct poster_image {
+	int found;		/* the input is recognised as such */
+	size_t start;		/* its operands, operator */
+	size_t dataoff, dataend;	/* ...and samples in the input */
+	int width, height, bpc, ncomp;
+	int colorimage;		/* else image */
+	int hex;		/* readhexstring, else readstring */
+	int linelen, eollen;	/* hex digits per line, line terminator */
+	double matrix[6];	/* image matrix */
+	double ctm[6];		/* from image user space to input units */
+};
+
+/* a %%Page of the input, tiled by itself */
+struct poster_page {
+	size_t off, end;	/* its part of the input */
+	int got_bb;		/* it had a %%PageBoundingBox */
+	double bb[4];		/* ...being this */
+	double imagebb[4];	/* its layout, as in the job */
+	double posterbb[4];
+	double scale;
+	int rotate, nrows, ncols;
+	int first;		/* its first tile in tiles[] */
+};
+
+/* what a job did, and where its time went (in seconds) */
+struct poster_stats {
+	double scantime;	/* poster_read: the input and its DSC comments */
+	double layouttime;	/* poster_layout: scale, rotation and grid */
+	double prologtime;	/* poster_output up to the first tile */
+	double tiletime;	/* ...and the tiles and trailer */
+	int nopens;		/* times the input was opened */
+	long nreads;		/* read() calls on it, none when mapped */
+	double outbytes;	/* output, before any compression */
+	double sinkbytes;	/* output as it reached the sink */
+	long *tilebytes;	/* output of each of tiles[], with tilestats */
+	int cached;		/* the output was copied from the cache */
+};
+
+struct poster_job {
+	/*** settings, as the command line options; NULL gives the default ***/
+	char *infile;		/* input file, NULL or "-" for stdin */
+	const char *indata;	/* or: input already in memory */
+	size_t inlen;
+	char *imagespec;	/* -i */
+	char *posterspec;	/* -p */
+	char *mediaspec;	/* -m */
+	char *cutmarginspec;	/* -c */
+	char *whitemarginspec;	/* -w */
+	char *scalespec;	/* -s */
+	int manualfeed;		/* -f */
+	int formmode;		/* -F: embed input once as a reusable form */
+	char *tilespec;		/* -t: print only these tiles, NULL for all */
+	int wholeimage;		/* -k: do not crop an image to each tile */
+	int pagemode;		/* -P: tile every %%Page of the input by itself */
+	int hoist;		/* -r: send the resources of its prolog once */
+	int strict;		/* -S: make every page independent, with its own DSC */
+	int maxsheets;		/* -L: refuse posters of more sheets, 0: no limit */
+	char *rollspec;		/* -R: print on a roll of the media width, in */
+				/* strips up to this long ("0": any length) */
+	int gzlevel;		/* -z: gzip the output at this level, 0 for not */
+	int gzthreads;		/* ...on this many threads, 0: one per cpu */
+	size_t spillsize;	/* -b: in-memory limit for piped input */
+	size_t writesize;	/* -W: write the output on a thread of its own, */
+				/* in buffers of this size; 0: write directly */
+	char *indexdir;		/* -X: directory to keep scan results in */
+	char *cachedir;		/* -K: directory to keep whole outputs in, */
+	size_t cachesize;	/* ...up to this many bytes together */
+	struct poster_mediadb *mediadb;	/* -M: media names and sizes, NULL for */
+				/* the built-in table; not owned by the job */
+	int tilestats;		/* -J: count the output of every tile, */
+				/* in stats.tilebytes */
+	char *creator;		/* for the %%Creator comment */
+	int verbose;		/* -v */
+	FILE *log;		/* verbose messages go here, NULL for none */
+
+	/*** results of the layout, in ps units ***/
+	double mediasize[4];	/* [23] = size of media to print on, [01] not used! */
+	double cutmargin[2];
+	double whitemargin[2];
+	double sheetsize[4];	/* [23] = size of each sheet printed: the media, */
+				/* or on a roll a piece of a strip */
+	double sheetmargin[2];	/* the cutmargin on it; on a roll, only */
+				/* where pieces meet */
+	double imagebb[4];	/* original image */
+	double posterbb[4];	/* final image */
+	double scale;		/* linear scaling factor */
+	int rotate, nrows, ncols;
+	int *tiles, ntiles;	/* the tiles to print, as row*ncols+col */
+				/* (with -P: of the pages in turn); */
+				/* NULL when all are printed, in order */
+
+	/*** the input, read only once ***/
+	char *inname;		/* input name for messages and comments */
+	char *inbuf;		/* complete input contents */
+	size_t insize;
+	int inmapped;		/* inbuf is mmap()ed, else malloc()ed or caller's */
+	int inregular;		/* input is a regular file, with: */
+	long indev, inino, inmtime, inctime;	/* ...its identity */
+	long inmnsec, incnsec;	/* ...to the nanosecond */
+	unsigned long long inhash;	/* hash of inbuf, with a cachedir */
+	int got_bb;		/* input had a %%BoundingBox */
+	double ps_bb[4];	/* ...being this */
+	struct poster_span *spans;	/* byte ranges of inbuf copied per tile */
+	int nspans, maxspans;
+	long bodysize;		/* sum of all span lengths */
+	int tail_cntl_D;	/* input ended with a cntl-D */
+	char *dsclines;		/* input DSC lines repeated in the output header */
+	size_t dsclen, dscalloc;
+	struct poster_image image;	/* the input is just this image */
+	struct poster_page *pages;	/* its %%Page comments */
+	int npages, maxpages;
+	size_t trailer;		/* where its %%Trailer is */
+	struct poster_span *resources;	/* its %%BeginResource blocks of the */
+	int nresources, maxresources;	/* prolog and document setup */
+	long resbytes;		/* of bodysize, in those; sent once with -r */
+	struct poster_pdf *pdf;	/* or: the input is a PDF, with this structure */
+
+	struct poster_stats stats;	/* filled in by the steps below */
+
+	char errmsg[POSTER_MSGSIZE];
+	int errbox;		/* the error was a box specification */
+};
+
+/* set all defaults, before filling in the settings */
+void poster_init( struct poster_job *job);
+/* release everything the job allocated */
+void poster_free( struct poster_job *job);
+
+/* the steps of a job, in this order: */
+/* decide media and margins */
+int poster_media( struct poster_job *job);
+/* read the input and scan its DSC comments */
+int poster_read( struct poster_job *job);
+/* decide the image size, scale, rotation and number of tiles */
+int poster_layout( struct poster_job *job);
+/* write a document with npages tiles, from tile first (0 based) on; */
+/* these count the tiles to print (see tilespec), of which there are ntiles */
+int poster_output( struct poster_job *job, struct poster_sink *sink,
+		   int first, int npages);
+
+/* the expected size of that document, to reserve room for it */
+long poster_outsize( struct poster_job *job, int first, int npages);
+
+/* all of the above, writing all tiles to print */
+int poster_run( struct poster_job *job, struct poster_sink *sink);
+
+/*** planning: the layouts a job could get, without doing it ***/
+/* read only what the layout needs: the DSC header (and (atend) */
+/* trailer) of the input, or the page tree of a PDF */
+int poster_readheader( struct poster_job *job);
+
+/* one way to print the poster */
+struct poster_plan {
+	char media[32];		/* sheets of this media */
+	double mediasize[2];	/* ...being this, portrait, in ps units */
+	int rotate;		/* the image is turned on them */
+	int nrows, ncols, nsheets;
+	double scale;
+	double paper;		/* area of the sheets, in square meters */
+	char lastcol[32];	/* smaller media that would do for the last */
+	char lastrow[32];	/* column and row, "" when there are none */
+	double smallpaper;	/* area of the sheets, with those */
+	double waste;		/* part of that not covered by the poster */
+	long bytes;		/* expected size of the output */
+};
+
+/* the layouts of the job (after poster_media, and poster_readheader */
+/* or poster_read unless there is an imagespec) on all media of the */
+/* table, both ways: fewest sheets first, then least paper. */
+/* Fills at most maxplans, and returns how many there are, or -1 */
+int poster_plan( struct poster_job *job, struct poster_plan *plans, int maxplans);
+
+/* write job->stats, with the layout, as a JSON object */
+int poster_stats_json( struct poster_job *job, FILE *fp);
+
+/* write the tiles to files named by pattern (with one %d), */
+/* balanced over ngroups files (0: one per tile), nthreads in parallel */
+int poster_split( struct poster_job *job, char *pattern,
+		  int ngroups, int nthreads);
+/* outcome of one file of a batch */
+struct poster_result {
+	char *infile;
+	char outfile[POSTER_MSGSIZE];
+	int status;		/* 0 when fine, -1 when failed */
+	int npages;
+	long bytes;		/* output size */
+	double seconds;		/* wall clock time */
+	char errmsg[POSTER_MSGSIZE];
+};
+
+/* convert nfiles files with the same settings, nthreads in parallel: */
+/* job has been through poster_media() and serves as template for all */
+/* files; output names are made from pattern, where %s stands for the */
+/* input name without directory and extension. */
+/* results[nfiles] gets the outcome per file, the return value is the */
+/* number of failed files, or -1 if the batch could not start at all */
+int poster_batch( struct poster_job *job, char **files, int nfiles,
+		  char *pattern, int nthreads, struct poster_result *results);
+/* make the output name for infile from a batch pattern */
+int poster_batchname( struct poster_job *job, char *pattern, char *infile,
+		      char *name, size_t size);
+
+/* check that pattern holds exactly one %d */
+int poster_checkpattern( struct poster_job *job, char *pattern);
+
+/* convert user box and margin specs into ps units */
+int poster_box_convert( struct poster_job *job, char *boxspec, double psbox[4]);
+int poster_margin_convert( struct poster_job *job, char *spec, double margin[2]);
+/* select tiles from a spec like '3,5-7' (page numbers) or '2:1-3' (row:col) */
+int poster_tiles_convert( struct poster_job *job, char *spec);
+/* convert a size like '4096', '64k', '16M' into bytes */
+int poster_size_convert( struct poster_job *job, char *spec, size_t *size);
+/* explain the box syntax, after a box_convert error */
+void poster_boxhelp( struct poster_job *job, FILE *fp);
+
+/* a media database: the built-in media and units, with those of file */
+/* added (see poster(1)); with job->indexdir it is parsed only once. */
+/* Jobs share it read-only through job->mediadb. NULL on errors */
+struct poster_mediadb *poster_mediadb_load( struct poster_job *job, char *file);
+void poster_mediadb_free( struct poster_mediadb *db);
+
+#endif